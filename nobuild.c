@@ -1,18 +1,603 @@
 #define NOBUILD_IMPLEMENTATION
 #include "./nobuild.h"
 
+#include <signal.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/wait.h>
+
 #define CFLAGS "-Wall", "-Wextra", "-std=c11", "-pedantic", "-ggdb"
 
+// Starts the command with its stdout and stderr sent into the files
+pid_t start(Cstr_Array line, Cstr out_path, Cstr err_path)
+{
+    Cstr_Array args = cstr_array_append(line, NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        PANIC("could not fork: %s", strerror(errno));
+    }
+
+    if (pid == 0) {
+        Fd out = fd_open_for_write(out_path);
+        Fd err = fd_open_for_write(err_path);
+        dup2(out, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+        execvp(args.elems[0], (char * const *) args.elems);
+        fprintf(stderr, "could not run %s: %s\n", args.elems[0], strerror(errno));
+        exit(127);
+    }
+    return pid;
+}
+
+// Runs the command with its stdout and stderr sent into the files and
+// returns its exit code
+int run(Cstr_Array line, Cstr out_path, Cstr err_path)
+{
+    pid_t pid = start(line, out_path, err_path);
+    int wstatus = 0;
+    if (waitpid(pid, &wstatus, 0) < 0) {
+        PANIC("could not wait on %s: %s", line.elems[0], strerror(errno));
+    }
+    return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128;
+}
+
+char *read_entire_file(Cstr path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = malloc((size_t) n + 1);
+    *size = fread(data, 1, (size_t) n, f);
+    fclose(f);
+    return data;
+}
+
+bool files_equal(Cstr a, Cstr b)
+{
+    size_t a_size = 0;
+    size_t b_size = 0;
+    char *a_data = read_entire_file(a, &a_size);
+    char *b_data = read_entire_file(b, &b_size);
+    bool equal = a_data != NULL && b_data != NULL && a_size == b_size && memcmp(a_data, b_data, a_size) == 0;
+    free(a_data);
+    free(b_data);
+    return equal;
+}
+
+#define BENCH_ROWS 4096
+#define BENCH_COLS 256
+
+// Every formula adds up the cell above it, so the evaluation walks down
+// the columns
+void generate_column_sum(Cstr path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        PANIC("could not open file %s: %s", path, strerror(errno));
+    }
+
+    for (size_t row = 0; row < BENCH_ROWS; ++row) {
+        for (size_t col = 0; col < BENCH_COLS; ++col) {
+            if (col > 0) {
+                fputc('|', f);
+            }
+            if (row == 0) {
+                fprintf(f, "%zu", col);
+            } else if (row == 1) {
+                fputs(col == 0 ? "=A0+1" : ":<", f);
+            } else {
+                fputs(":^", f);
+            }
+        }
+        fputc('\n', f);
+    }
+
+    fclose(f);
+}
+
+// Every formula adds up the cell to the left of it, so the evaluation
+// walks along the rows
+void generate_row_sum(Cstr path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        PANIC("could not open file %s: %s", path, strerror(errno));
+    }
+
+    for (size_t row = 0; row < BENCH_ROWS; ++row) {
+        for (size_t col = 0; col < BENCH_COLS; ++col) {
+            if (col > 0) {
+                fputc('|', f);
+            }
+            if (col == 0) {
+                fprintf(f, "%zu", row);
+            } else if (col == 1) {
+                fputs(row == 0 ? "=A0+1" : ":^", f);
+            } else {
+                fputs(":<", f);
+            }
+        }
+        fputc('\n', f);
+    }
+
+    fclose(f);
+}
+
+// The number after `"key":` in the output of --stats=json, 0 when the key
+// is missing
+double json_number(Cstr json, Cstr key)
+{
+    Cstr pattern = CONCAT("\"", key, "\":");
+    Cstr at = strstr(json, pattern);
+    return at == NULL ? 0 : strtod(at + strlen(pattern), NULL);
+}
+
+// Evaluates the same sheets with every layout of the cells (--layout) and
+// reports the time of the evaluation, the memory taken by the cells and
+// the peak RSS of every run. Vectorization is disabled since only the row
+// layout supports it.
+void bench(void)
+{
+    MKDIRS("bench");
+    generate_column_sum(PATH("bench", "column-sum.csv"));
+    generate_row_sum(PATH("bench", "row-sum.csv"));
+
+    Cstr workloads[] = {"column-sum", "row-sum"};
+    Cstr layouts[] = {"rows", "columns", "tiles"};
+    INFO("%-10s %-8s %10s %12s %9s %12s", "sheet", "layout", "eval (s)", "cell bytes", "per cell", "peak RSS");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i) {
+        for (size_t j = 0; j < sizeof(layouts) / sizeof(layouts[0]); ++j) {
+            Cstr input = PATH("bench", CONCAT(workloads[i], ".csv"));
+            Cstr stats = PATH("bench", CONCAT(workloads[i], "-", layouts[j], ".json"));
+            Cstr_Array line = cstr_array_make("./minicel", "--stats=json", "--no-vectorize",
+                                              CONCAT("--layout=", layouts[j]), "-o", "/dev/null",
+                                              input, NULL);
+            if (run(line, "/dev/null", stats) != 0) {
+                PANIC("could not evaluate %s with --layout=%s, see %s", input, layouts[j], stats);
+            }
+
+            size_t size = 0;
+            char *json = read_entire_file(stats, &size);
+            json[size] = '\0';
+            double cell_bytes = json_number(json, "cell_bytes");
+            double stored_cells = json_number(json, "stored_cells");
+            INFO("%-10s %-8s %10.3f %12.0f %9.0f %10.1fMB",
+                 workloads[i], layouts[j],
+                 json_number(json, "eval"),
+                 cell_bytes,
+                 stored_cells > 0 ? cell_bytes / stored_cells : 0,
+                 json_number(json, "peak_rss_bytes") / (1024.0 * 1024.0));
+            free(json);
+        }
+    }
+}
+
+// Tests
+//
+// Every tests/<name>.csv comes with the expected stdout in
+// tests/<name>.out, which every mode in test_modes has to reproduce, or
+// with the expected stderr in tests/<name>.err of a run that fails. A mode
+// whose output is expected to differ, like --pipeline that writes the rows
+// of a ragged sheet without padding them, has to reproduce
+// tests/<name>.<mode>.out instead, if it exists. The options in
+// tests/<name>.args, if any, are passed after the input, and such a sheet
+// is only run in the default mode.
+
+#define TEST_DIR "tests"
+#define TEST_OUTPUT_DIR PATH(TEST_DIR, "output")
+
+// The modes that must not change what a sheet evaluates to
+Cstr test_modes[][3] = {
+    {NULL},
+    {"--no-vectorize", NULL},
+    {"--layout=columns", NULL},
+    {"--layout=tiles", NULL},
+    {"--lazy", NULL},
+    {"--pipeline", NULL},
+    {"-j", "4", NULL},
+    {"--index", NULL},
+    {"--max-memory", "1M", NULL},
+    {"--text-pool", NULL},
+};
+
+// The sheets with a text header that the Arrow output is read back from
+Cstr arrow_sheets[] = {
+    "input.csv",
+    "tests/arrow.csv",
+};
+
+size_t failed_tests = 0;
+
+void test_fail(Cstr fmt, ...) NOBUILD_PRINTF_FORMAT(1, 2);
+
+void test_fail(Cstr fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    VLOG(stderr, "FAIL", fmt, args);
+    va_end(args);
+    failed_tests += 1;
+}
+
+// The options separated by whitespace in tests/<name>.args
+Cstr_Array test_args(Cstr name)
+{
+    Cstr_Array args = {0};
+    size_t size = 0;
+    char *data = read_entire_file(PATH(TEST_DIR, CONCAT(name, ".args")), &size);
+    if (data == NULL) {
+        return args;
+    }
+
+    data[size] = '\0';
+    for (char *arg = strtok(data, " \t\n"); arg != NULL; arg = strtok(NULL, " \t\n")) {
+        args = cstr_array_append(args, arg);
+    }
+    return args;
+}
+
+Cstr_Array append_args(Cstr_Array line, Cstr_Array args)
+{
+    for (size_t i = 0; i < args.count; ++i) {
+        line = cstr_array_append(line, args.elems[i]);
+    }
+    return line;
+}
+
+void test_sheet(Cstr name)
+{
+    Cstr input = PATH(TEST_DIR, CONCAT(name, ".csv"));
+    Cstr_Array args = test_args(name);
+    Cstr expected_out = PATH(TEST_DIR, CONCAT(name, ".out"));
+    Cstr expected_err = PATH(TEST_DIR, CONCAT(name, ".err"));
+    Cstr out = PATH(TEST_OUTPUT_DIR, CONCAT(name, ".out"));
+    Cstr err = PATH(TEST_OUTPUT_DIR, CONCAT(name, ".err"));
+
+    if (PATH_EXISTS(expected_err)) {
+        int code = run(append_args(cstr_array_make("./minicel", input, NULL), args), out, err);
+        if (code != 1 || !files_equal(err, expected_err)) {
+            test_fail("%s: expected the errors in %s, got exit code %d and %s", input, expected_err, code, err);
+        }
+        return;
+    }
+
+    size_t modes = args.count > 0 ? 1 : sizeof(test_modes) / sizeof(test_modes[0]);
+    for (size_t i = 0; i < modes; ++i) {
+        Cstr_Array line = cstr_array_make("./minicel", NULL);
+        Cstr mode = "default";
+        for (size_t j = 0; test_modes[i][j] != NULL; ++j) {
+            line = cstr_array_append(line, test_modes[i][j]);
+            mode = j == 0 ? test_modes[i][j] : CONCAT(mode, " ", test_modes[i][j]);
+        }
+        line = cstr_array_append(line, input);
+        line = append_args(line, args);
+
+        Cstr expected = expected_out;
+        if (test_modes[i][0] != NULL) {
+            Cstr mode_out = PATH(TEST_DIR, CONCAT(name, ".", test_modes[i][0] + strspn(test_modes[i][0], "-"), ".out"));
+            if (PATH_EXISTS(mode_out)) {
+                expected = mode_out;
+            }
+        }
+
+        int code = run(line, out, err);
+        if (code != 0 || !files_equal(out, expected)) {
+            test_fail("%s (%s): expected %s, got exit code %d and %s", input, mode, expected, code, out);
+        }
+    }
+}
+
+// The text output and the Arrow output read back by tests/arrow_dump.c
+// must have the same column names, values and empty cells
+void test_arrow(Cstr input)
+{
+    Cstr slash = strrchr(input, '/');
+    Cstr name = NOEXT(slash != NULL ? slash + 1 : input);
+    Cstr text = PATH(TEST_OUTPUT_DIR, CONCAT(name, ".text"));
+    Cstr arrow = PATH(TEST_OUTPUT_DIR, CONCAT(name, ".arrow"));
+    Cstr dump = PATH(TEST_OUTPUT_DIR, CONCAT(name, ".dump"));
+    Cstr err = PATH(TEST_OUTPUT_DIR, CONCAT(name, ".err"));
+
+    if (run(cstr_array_make("./minicel", input, NULL), text, err) != 0 ||
+        run(cstr_array_make("./minicel", "--arrow", input, NULL), arrow, err) != 0) {
+        test_fail("%s: could not evaluate, see %s", input, err);
+        return;
+    }
+
+    if (run(cstr_array_make(PATH(TEST_OUTPUT_DIR, "arrow_dump"), arrow, NULL), dump, err) != 0) {
+        test_fail("%s: could not read the Arrow output back, see %s", input, err);
+    } else if (!files_equal(dump, text)) {
+        test_fail("%s: the Arrow output in %s does not match the text output in %s", input, dump, text);
+    }
+}
+
+// The versions of a sheet that test_watch() saves one after another. Every
+// version changes a few cells of the previous one, so the watcher updates
+// the table in place. The versions with errors have to keep the last good
+// table in the output.
+typedef struct {
+    Cstr content;
+    bool good;
+} Watch_Step;
+
+Watch_Step watch_steps[] = {
+    {"1|10|=A0+B0|:<\n2|20|:^|:^\n3|30|:^|:^\n4|40|:^|:^\n=A0+A1|:<|:<|:<\n", true},
+    {"1|10|=A0+B0|:<\n7|20|:^|:^\n3|30|:^|:^\n4|40|:^|:^\n=A0+A1|:<|:<|:<\n", true},
+    {"1|10|=A0+|:<\n7|20|:^|:^\n3|30|:^|:^\n4|40|:^|:^\n=A0+A1|:<|:<|:<\n", false},
+    {"1|10|=B0+B0|:<\n7|20|:^|:^\n3|30|:^|:^\n4|40|:^|:^\n=A0+A1|:<|:<|:<\n", true},
+    {"1|10|=B0+B0|:<\n7|20|:^|=Z9\n3|30|:^|:^\n4|40|:^|:^\n=A0+A1|:<|:<|:<\n", false},
+    {"1|10|=C1|:<\n7|20|:^|:^\n3|30|:^|:^\n4|40|:^|:^\n=A0+A1|:<|:<|:<\n", false},
+    {"1|10|=B0+B0|:<\n7|20|:^|:^\n3|100|:^|:^\n4|40|:^|:^\n=A0+A1|:<|:<|:<\n", true},
+    // A new copy of a formula whose references have been linked already
+    {"1|10|=B0+B0|:<\n7|20|:^|:^\n3|100|:^|:^\n=A2|40|:^|:^\n=A0+A1|:<|:<|:<\n", true},
+    {"1|10|=B0+B0|:<\n7|20|:^|:^\n3|100|:^|:^\n=A2|:<|:^|:^\n=A0+A1|:<|:<|:<\n", true},
+};
+
+void write_entire_file(Cstr path, Cstr content)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        PANIC("could not open file %s: %s", path, strerror(errno));
+    }
+    fputs(content, f);
+    fclose(f);
+}
+
+size_t count_occurrences(Cstr path, Cstr needle)
+{
+    size_t size = 0;
+    char *data = read_entire_file(path, &size);
+    size_t count = 0;
+    if (data != NULL) {
+        data[size] = '\0';
+        for (char *at = strstr(data, needle); at != NULL; at = strstr(at + 1, needle)) {
+            count += 1;
+        }
+    }
+    free(data);
+    return count;
+}
+
+// The options that only add a report to a run, the file the report is
+// written to (NULL for stderr) and a text the report has to contain
+typedef struct {
+    Cstr options[5];
+    Cstr report;
+    Cstr needle;
+} Report_Test;
+
+Report_Test report_tests[] = {
+    {{"--stats", NULL}, NULL, "peak rss bytes"},
+    {{"--stats=json", NULL}, NULL, "\"peak_rss_bytes\":"},
+    // The end of the trace is only written once every thread has stopped
+    {{"--trace", "tests/output/trace.json", NULL}, "tests/output/trace.json", "\n]}"},
+    {{"--trace", "tests/output/trace.json", "-j", "4"}, "tests/output/trace.json", "\n]}"},
+    {{"--profile", NULL}, NULL, " formulas by inclusive "},
+    {{"--profile=1", "--lazy", NULL}, NULL, " formulas by inclusive "},
+    // The counters are missing in containers and VMs without a PMU, which
+    // still reports every phase
+    {{"--perf", NULL}, NULL, "branch_misses"},
+    {{"--perf", "--stats=json", NULL}, NULL, "\"perf\":{\"read\":"},
+};
+
+// Evaluates the sheet once with every option of report_tests, which must
+// not change the output
+void test_reports(Cstr name)
+{
+    Cstr input = PATH(TEST_DIR, CONCAT(name, ".csv"));
+    Cstr expected_out = PATH(TEST_DIR, CONCAT(name, ".out"));
+    Cstr out = PATH(TEST_OUTPUT_DIR, CONCAT(name, ".out"));
+    Cstr err = PATH(TEST_OUTPUT_DIR, CONCAT(name, ".err"));
+    if (!PATH_EXISTS(expected_out) || PATH_EXISTS(PATH(TEST_DIR, CONCAT(name, ".args")))) {
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(report_tests) / sizeof(report_tests[0]); ++i) {
+        Cstr_Array line = cstr_array_make("./minicel", NULL);
+        Cstr mode = NULL;
+        for (size_t j = 0; report_tests[i].options[j] != NULL; ++j) {
+            line = cstr_array_append(line, report_tests[i].options[j]);
+            mode = j == 0 ? report_tests[i].options[j] : CONCAT(mode, " ", report_tests[i].options[j]);
+        }
+        line = cstr_array_append(line, input);
+
+        Cstr report = report_tests[i].report != NULL ? report_tests[i].report : err;
+        remove(report);
+        int code = run(line, out, err);
+        if (code != 0 || !files_equal(out, expected_out)) {
+            test_fail("%s (%s): expected %s, got exit code %d and %s", input, mode, expected_out, code, out);
+        } else if (count_occurrences(report, report_tests[i].needle) == 0) {
+            test_fail("%s (%s): expected %s in the report %s", input, mode, report_tests[i].needle, report);
+        }
+    }
+}
+
+#define WATCH_TIMEOUT_MS 5000
+
+// Saves every version of watch_steps while `./minicel --watch` is running
+// and checks that the output it updates equals a full run on the same
+// version, or stays the same for the versions with errors
+void test_watch(void)
+{
+#ifdef __linux__
+    Cstr input = PATH(TEST_OUTPUT_DIR, "watch.csv");
+    Cstr output = PATH(TEST_OUTPUT_DIR, "watch.out");
+    Cstr errors = PATH(TEST_OUTPUT_DIR, "watch.err");
+    Cstr full_input = PATH(TEST_OUTPUT_DIR, "watch-full.csv");
+    Cstr full_output = PATH(TEST_OUTPUT_DIR, "watch-full.out");
+    Cstr full_errors = PATH(TEST_OUTPUT_DIR, "watch-full.err");
+
+    remove(output);
+    write_entire_file(input, watch_steps[0].content);
+    pid_t pid = start(cstr_array_make("./minicel", "--watch", input, "-o", output, NULL), "/dev/null", errors);
+
+    size_t rejected = 0;
+    for (size_t i = 0; i < sizeof(watch_steps) / sizeof(watch_steps[0]); ++i) {
+        if (i > 0) {
+            write_entire_file(input, watch_steps[i].content);
+        }
+
+        if (watch_steps[i].good) {
+            write_entire_file(full_input, watch_steps[i].content);
+            if (run(cstr_array_make("./minicel", full_input, NULL), full_output, full_errors) != 0) {
+                test_fail("version %zu of %s does not evaluate, see %s", i, input, full_errors);
+                break;
+            }
+        } else {
+            rejected += 1;
+        }
+
+        // The output is rewritten in place, so it is read until it matches
+        bool done = false;
+        for (size_t ms = 0; ms < WATCH_TIMEOUT_MS && !done; ms += 10) {
+            if (watch_steps[i].good) {
+                done = files_equal(output, full_output);
+            } else {
+                done = count_occurrences(errors, "keeps the last good table") == rejected;
+            }
+            if (!done) {
+                nanosleep(&(struct timespec) {.tv_nsec = 10 * 1000 * 1000}, NULL);
+            }
+        }
+
+        if (!done) {
+            test_fail("--watch did not pick up version %zu of %s, see %s", i, input, errors);
+            break;
+        }
+        if (!watch_steps[i].good && !files_equal(output, full_output)) {
+            test_fail("--watch did not keep the last good table for version %zu of %s", i, input);
+            break;
+        }
+        if (waitpid(pid, NULL, WNOHANG) != 0) {
+            test_fail("--watch exited after version %zu of %s, see %s", i, input, errors);
+            return;
+        }
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+#endif
+}
+
+// The versions of a sheet that test_cache() evaluates one after another
+// with the same --cache, and how many rows every run has to take from the
+// entry of the previous one. Row 1 copies the text of row 0, so it is never
+// taken from the entry but reads the formula of the row above it. Rows 3
+// to 5 depend on the rows above them.
+typedef struct {
+    Cstr content;
+    size_t cached_rows;
+} Cache_Step;
+
+Cache_Step cache_steps[] = {
+    {"1|10|=A0+B0|x\n2|20|:^|:^\n3|30|=A2+B2|y\n=A0+A2|:<|:<|z\n4|40|=A3+B4|w\n5|50|=A4+B5|v\n", 0},
+    {"1|10|=A0+B0|x\n2|20|:^|:^\n3|30|=A2+B2|y\n=A0+A2|:<|:<|z\n4|40|=A3+B4|w\n5|50|=A4+B5|v\n", 5},
+    // The rows below a changed row that they read from
+    {"1|10|=A0+B0|x\n2|20|:^|:^\n6|30|=A2+B2|y\n=A0+A2|:<|:<|z\n4|40|=A3+B4|w\n5|50|=A4+B5|v\n", 1},
+    // A changed row that copies the formula of a cached one
+    {"1|10|=A0+B0|x\n2|70|:^|:^\n6|30|=A2+B2|y\n=A0+A2|:<|:<|z\n4|40|=A3+B4|w\n5|50|=A4+B5|v\n", 5},
+    // A changed text that is copied
+    {"1|10|=A0+B0|u\n2|70|:^|:^\n6|30|=A2+B2|y\n=A0+A2|:<|:<|z\n4|40|=A3+B4|w\n5|50|=A4+B5|v\n", 1},
+    {"1|10|=A0+B0|u\n2|70|:^|:^\n6|30|=A2+B2|y\n=A0+A2|:<|:<|z\n4|40|=A3+B4|w\n5|50|=A4+B4|v\n", 4},
+    // A change in the width of the table
+    {"1|10|=A0+B0|u\n2|70|:^|:^\n6|30|=A2+B2|y\n=A0+A2|:<|:<|z\n4|40|=A3+B4|w\n5|50|=A4+B4|v|8\n", 0},
+};
+
+// Evaluates every version of cache_steps with --cache and checks that the
+// output equals a run without the cache and that the expected rows were
+// taken from the entry
+void test_cache(void)
+{
+    Cstr input = PATH(TEST_OUTPUT_DIR, "cache.csv");
+    Cstr cache_dir = PATH(TEST_OUTPUT_DIR, "cache");
+    Cstr output = PATH(TEST_OUTPUT_DIR, "cache.out");
+    Cstr stats = PATH(TEST_OUTPUT_DIR, "cache.json");
+    Cstr full_output = PATH(TEST_OUTPUT_DIR, "cache-full.out");
+    Cstr full_errors = PATH(TEST_OUTPUT_DIR, "cache-full.err");
+
+    if (PATH_EXISTS(cache_dir)) {
+        RM(cache_dir);
+    }
+
+    for (size_t i = 0; i < sizeof(cache_steps) / sizeof(cache_steps[0]); ++i) {
+        write_entire_file(input, cache_steps[i].content);
+        if (run(cstr_array_make("./minicel", input, NULL), full_output, full_errors) != 0) {
+            test_fail("version %zu of %s does not evaluate, see %s", i, input, full_errors);
+            return;
+        }
+
+        int code = run(cstr_array_make("./minicel", "--cache", cache_dir, "--stats=json", input, NULL),
+                       output, stats);
+        if (code != 0 || !files_equal(output, full_output)) {
+            test_fail("version %zu of %s with --cache: expected %s, got exit code %d and %s",
+                      i, input, full_output, code, output);
+            return;
+        }
+
+        size_t size = 0;
+        char *json = read_entire_file(stats, &size);
+        json[size] = '\0';
+        size_t cached_rows = (size_t) json_number(json, "cached_rows");
+        free(json);
+        if (cached_rows != cache_steps[i].cached_rows) {
+            test_fail("version %zu of %s with --cache: expected %zu cached rows, got %zu, see %s",
+                      i, input, cache_steps[i].cached_rows, cached_rows, stats);
+            return;
+        }
+    }
+}
+
+void test(void)
+{
+    MKDIRS(TEST_OUTPUT_DIR);
+    CMD("gcc", CFLAGS, "-o", PATH(TEST_OUTPUT_DIR, "arrow_dump"), PATH(TEST_DIR, "arrow_dump.c"));
+
+    // The tests may leave errno set, which FOREACH_FILE_IN_DIR would
+    // take for an error of readdir()
+    Cstr_Array sheets = {0};
+    FOREACH_FILE_IN_DIR(file, TEST_DIR, {
+        if (ENDS_WITH(file, ".csv")) {
+            sheets = cstr_array_append(sheets, NOEXT(file));
+        }
+    });
+    for (size_t i = 0; i < sheets.count; ++i) {
+        test_sheet(sheets.elems[i]);
+        test_reports(sheets.elems[i]);
+    }
+
+    for (size_t i = 0; i < sizeof(arrow_sheets) / sizeof(arrow_sheets[0]); ++i) {
+        test_arrow(arrow_sheets[i]);
+    }
+
+    test_watch();
+    test_cache();
+
+    if (failed_tests > 0) {
+        PANIC("%zu of the tests failed", failed_tests);
+    }
+    INFO("%zu sheets, %zu report options, %zu Arrow round trips, %zu versions of a watched sheet and %zu versions of a cached sheet passed",
+         sheets.count, sizeof(report_tests) / sizeof(report_tests[0]), sizeof(arrow_sheets) / sizeof(arrow_sheets[0]),
+         sizeof(watch_steps) / sizeof(watch_steps[0]), sizeof(cache_steps) / sizeof(cache_steps[0]));
+}
+
 int main(int argc, char **argv)
 {
     GO_REBUILD_URSELF(argc, argv);
 
-    // CMD("clang", CFLAGS, "-fsanitize=memory", "-o", "minicel", "src/main.c");
-    CMD("gcc", CFLAGS, "-o", "minicel", "src/main.c");
+    // CMD("clang", CFLAGS, "-fsanitize=memory", "-o", "minicel", "src/main.c", "-pthread");
+    CMD("gcc", CFLAGS, "-o", "minicel", "src/main.c", "-pthread");
 
     if (argc > 1) {
         if (strcmp(argv[1], "run") == 0) {
             CMD("./minicel", "input.csv");
+        } else if (strcmp(argv[1], "bench") == 0) {
+            bench();
+        } else if (strcmp(argv[1], "test") == 0) {
+            test();
         } else if (strcmp(argv[1], "gdb") == 0) {
             CMD("gdb", "./minicel");
         } else {
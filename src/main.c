@@ -1,18 +1,61 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <setjmp.h>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#    if __has_include(<linux/io_uring.h>)
+#        define MINICEL_IO_URING
+#        include <linux/io_uring.h>
+#        include <sys/syscall.h>
+#    endif
+#    if __has_include(<linux/perf_event.h>)
+#        define MINICEL_PERF_EVENT
+#        include <linux/perf_event.h>
+#        include <sys/ioctl.h>
+#        include <sys/syscall.h>
+#    endif
+#    if __has_include(<sys/inotify.h>)
+#        define MINICEL_INOTIFY
+#        include <sys/inotify.h>
+#    endif
+#endif
 
 #define SV_IMPLEMENTATION
 #include "./sv.h"
 
 typedef struct Expr Expr;
-typedef size_t Expr_Index;
+// 32 bits keep the cells small (see Cell), expr_buffer_alloc() makes sure
+// the expressions fit
+typedef uint32_t Expr_Index;
 
 typedef enum {
     EXPR_KIND_NUMBER = 0,
     EXPR_KIND_CELL,
+    EXPR_KIND_REL_CELL,
+    // A reference linked by table_link_refs()
+    EXPR_KIND_CELL_INDEX,
     EXPR_KIND_PLUS,
 } Expr_Kind;
 
@@ -26,9 +69,19 @@ typedef struct {
     size_t col;
 } Expr_Cell;
 
+// A reference relative to the cell that hosts the expression. The copies
+// of a formula (see CELL_KIND_CLONE) all share a single tree of these.
+typedef struct {
+    ptrdiff_t drow;
+    ptrdiff_t dcol;
+} Expr_Rel_Cell;
+
 typedef union {
     double number;
     Expr_Cell cell;
+    Expr_Rel_Cell rel_cell;
+    // Index of the referenced cell in Table.cells
+    size_t cell_index;
     Expr_Plus plus;
 } Expr_As;
 
@@ -37,12 +90,193 @@ struct Expr {
     Expr_As as;
 };
 
+// Paged storage (--max-memory)
+//
+// Under a memory budget the cells and the expressions are kept in a
+// temporary file mapped into memory instead of the heap, and the input
+// is mapped instead of read. All these pages are backed by files, so the
+// kernel may write them out and drop them like the rest of the page
+// cache, with its own LRU lists acting as the buffer pool. On top of
+// that paged_tick() drops the pages from the RSS of the process every
+// time it grows past the budget, and they come back from the page cache
+// or the file once they are touched again.
+
+#define PAGED_REGIONS_CAPACITY 16
+// The RSS is checked every time the loops have walked through another
+// 1/PAGED_CHECK_FRACTION of the budget
+#define PAGED_CHECK_FRACTION 16
+
+// 0 is no budget
+size_t max_memory = 0;
+atomic_size_t paged_trims = 0;
+atomic_size_t paged_touched = 0;
+
+typedef struct {
+    char *data;
+    size_t size;
+    // The temporary file, -1 for a mapped input
+    int fd;
+} Paged_Region;
+
+Paged_Region paged_regions[PAGED_REGIONS_CAPACITY];
+size_t paged_regions_count = 0;
+
+Paged_Region *paged_find(void *data)
+{
+    for (size_t i = 0; i < paged_regions_count; ++i) {
+        if (paged_regions[i].data == data) {
+            return &paged_regions[i];
+        }
+    }
+    return NULL;
+}
+
+void paged_track(char *data, size_t size, int fd)
+{
+    assert(paged_regions_count < PAGED_REGIONS_CAPACITY);
+    paged_regions[paged_regions_count++] = (Paged_Region) {
+        .data = data,
+        .size = size,
+        .fd = fd,
+    };
+}
+
+// The temporary files go to $TMPDIR or /var/tmp, which unlike /tmp is
+// rarely kept in memory
+void *paged_alloc(size_t size)
+{
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || *dir == '\0') {
+        dir = "/var/tmp";
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/minicel-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: could not create a temporary file in %s: %s\n", dir, strerror(errno));
+        exit(1);
+    }
+    unlink(path);
+
+    if (size == 0) {
+        size = 1;
+    }
+    if (ftruncate(fd, (off_t) size) < 0) {
+        fprintf(stderr, "ERROR: could not grow a temporary file in %s: %s\n", dir, strerror(errno));
+        exit(1);
+    }
+
+    char *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(data != MAP_FAILED && "Buy more address space lol");
+    paged_track(data, size, fd);
+    return data;
+}
+
+// calloc() from the temporary files under a budget and from the heap otherwise
+void *paged_calloc(size_t count, size_t size)
+{
+    if (max_memory > 0) {
+        return paged_alloc(count * size);
+    }
+    return calloc(count > 0 ? count : 1, size);
+}
+
+// Same as realloc(), the contents stay in the file while it is mapped again
+void *paged_realloc(void *data, size_t size)
+{
+    if (data == NULL) {
+        return paged_alloc(size);
+    }
+
+    Paged_Region *region = paged_find(data);
+    assert(region != NULL && region->fd >= 0);
+    if (ftruncate(region->fd, (off_t) size) < 0) {
+        fprintf(stderr, "ERROR: could not grow a temporary file: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    munmap(region->data, region->size);
+    region->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, region->fd, 0);
+    assert(region->data != MAP_FAILED && "Buy more address space lol");
+    region->size = size;
+    return region->data;
+}
+
+// Frees the memory of paged_alloc(), the input mapped by main() or
+// anything that came from malloc()
+void paged_free(void *data)
+{
+    Paged_Region *region = paged_find(data);
+    if (region == NULL) {
+        free(data);
+        return;
+    }
+
+    munmap(region->data, region->size);
+    if (region->fd >= 0) {
+        close(region->fd);
+    }
+    *region = paged_regions[--paged_regions_count];
+}
+
+size_t current_rss_bytes(void)
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) {
+        return 0;
+    }
+
+    size_t pages = 0;
+    size_t resident = 0;
+    if (fscanf(f, "%zu %zu", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return resident * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+// Called once per unit of work (a row, a formula) by the loops over the
+// whole table with the number of bytes of the table that the unit
+// touches. The pages touched between two checks of the RSS add at most
+// max_memory / PAGED_CHECK_FRACTION to it, give or take the pages of the
+// formulas that refer to cells far away. --max-memory runs on a single
+// thread (see main()), so only the counters have to be atomic.
+void paged_tick(size_t bytes)
+{
+    if (max_memory == 0) {
+        return;
+    }
+
+    size_t step = max_memory / PAGED_CHECK_FRACTION;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    if (step < page) {
+        step = page;
+    }
+    size_t touched = atomic_fetch_add_explicit(&paged_touched, bytes, memory_order_relaxed);
+    if (touched / step == (touched + bytes) / step) {
+        return;
+    }
+
+    if (current_rss_bytes() <= max_memory) {
+        return;
+    }
+
+    for (size_t i = 0; i < paged_regions_count; ++i) {
+        madvise(paged_regions[i].data, paged_regions[i].size, MADV_DONTNEED);
+    }
+    atomic_fetch_add_explicit(&paged_trims, 1, memory_order_relaxed);
+}
+
 typedef struct {
     size_t count;
     size_t capacity;
     Expr *items;
 } Expr_Buffer;
 
+// Expr_Buffers are grown from several threads in --pipeline
+atomic_size_t expr_buffer_reallocs = 0;
+
 Expr_Index expr_buffer_alloc(Expr_Buffer *eb)
 {
     if (eb->count >= eb->capacity) {
@@ -53,10 +287,16 @@ Expr_Index expr_buffer_alloc(Expr_Buffer *eb)
             eb->capacity *= 2;
         }
 
-        eb->items = realloc(eb->items, sizeof(Expr) * eb->capacity);
+        atomic_fetch_add_explicit(&expr_buffer_reallocs, 1, memory_order_relaxed);
+        if (max_memory > 0) {
+            eb->items = paged_realloc(eb->items, sizeof(Expr) * eb->capacity);
+        } else {
+            eb->items = realloc(eb->items, sizeof(Expr) * eb->capacity);
+        }
     }
 
-    return eb->count++;
+    assert(eb->count < UINT32_MAX && "the expressions do not fit into Expr_Index");
+    return (Expr_Index) eb->count++;
 }
 
 Expr *expr_buffer_at(Expr_Buffer *eb, Expr_Index index)
@@ -69,6 +309,9 @@ typedef enum {
     CELL_KIND_TEXT = 0,
     CELL_KIND_NUMBER,
     CELL_KIND_EXPR,
+    CELL_KIND_CLONE,
+    // Only the text of the cell is known, see table_load_raw_cell()
+    CELL_KIND_RAW,
 } Cell_Kind;
 
 const char *cell_kind_as_cstr(Cell_Kind kind)
@@ -80,6 +323,10 @@ const char *cell_kind_as_cstr(Cell_Kind kind)
         return "NUMBER";
     case CELL_KIND_EXPR:
         return "EXPR";
+    case CELL_KIND_CLONE:
+        return "CLONE";
+    case CELL_KIND_RAW:
+        return "RAW";
     default:
         assert(0 && "unreachable");
         exit(1);
@@ -90,31 +337,525 @@ typedef enum {
     UNEVALUATED = 0,
     INPROGRESS,
     EVALUATED,
+    // Only the text of the formula is known, see table_parse_lazy_cell()
+    UNPARSED,
 } Eval_Status;
 
+typedef enum {
+    DIR_LEFT = 0,
+    DIR_RIGHT,
+    DIR_UP,
+    DIR_DOWN,
+} Dir;
+
+// A cell takes 16 bytes. Every kind of cell uses its own fields of the
+// struct below; the fields that are never used by the same kind share
+// the place in the unions. All the fields are explicit and the struct has
+// no padding, so setting one of them never changes the kind.
 typedef struct {
-    Expr_Index index;
-    Eval_Status status;
-    double value;
-} Cell_Expr;
+    union {
+        // CELL_KIND_NUMBER, or the value of an evaluated CELL_KIND_EXPR.
+        // Both are read the same way by table_eval_numeric().
+        double number;
+        double value;
+        // CELL_KIND_TEXT and CELL_KIND_RAW, see cell_text()
+        const char *text;
+        // The text of an UNPARSED CELL_KIND_EXPR without the leading `=`,
+        // see cell_source()
+        const char *source;
+    };
+    union {
+        uint32_t text_count;
+        uint32_t source_count;
+        // The expression of a parsed CELL_KIND_EXPR
+        Expr_Index index;
+        // The neighbor that a CELL_KIND_CLONE copies, Dir
+        uint32_t dir;
+    };
+    // Eval_Status of a CELL_KIND_EXPR
+    uint8_t status;
+    union {
+        // The expression has only relative references and is shared by the
+        // copies of the cell
+        bool relative;
+        // The CELL_KIND_CLONE is being resolved, see table_resolve_clone()
+        bool resolving;
+    };
+    uint8_t reserved;
+    // Cell_Kind
+    uint8_t kind;
+} Cell;
 
-typedef union {
-    String_View text;
-    double number;
-    Cell_Expr expr;
-} Cell_As;
+static_assert(sizeof(Cell) == 16, "the cells are packed into 16 bytes");
+static_assert(offsetof(Cell, kind) == sizeof(Cell) - 1, "the cell has no padding");
+
+String_View cell_text(const Cell *cell)
+{
+    return (String_View) {
+        .count = cell->text_count,
+        .data = cell->text,
+    };
+}
+
+void cell_set_text(Cell *cell, String_View text)
+{
+    assert(text.count <= UINT32_MAX && "the text of a cell is longer than 4GB");
+    cell->text = text.data;
+    cell->text_count = (uint32_t) text.count;
+}
+
+String_View cell_source(const Cell *cell)
+{
+    return (String_View) {
+        .count = cell->source_count,
+        .data = cell->source,
+    };
+}
+
+void cell_set_source(Cell *cell, String_View source)
+{
+    assert(source.count <= UINT32_MAX && "the formula of a cell is longer than 4GB");
+    cell->source = source.data;
+    cell->source_count = (uint32_t) source.count;
+}
 
 typedef struct {
-    Cell_Kind kind;
-    Cell_As as;
-} Cell;
+    Cell *cells;
+    size_t count;
+} Row;
+
+// Order of the cells in Table.cells (--layout)
+typedef enum {
+    LAYOUT_ROWS = 0,
+    LAYOUT_COLUMNS,
+    // Square tiles of TILE_SIZE x TILE_SIZE cells, the tiles and the cells
+    // inside of them go row by row. The tiles on the right and bottom edges
+    // are padded with empty cells.
+    LAYOUT_TILES,
+} Layout;
+
+#define TILE_SIZE 64
+
+const char *layout_as_cstr(Layout layout)
+{
+    switch (layout) {
+    case LAYOUT_ROWS:
+        return "rows";
+    case LAYOUT_COLUMNS:
+        return "columns";
+    case LAYOUT_TILES:
+        return "tiles";
+    default:
+        assert(0 && "unreachable");
+        exit(1);
+    }
+}
 
 typedef struct {
     Cell *cells;
     size_t rows;
     size_t cols;
+    Layout layout;
+    // Tables that are built row by row (see --pipeline) keep every row
+    // separately in row_items and leave cells NULL. The cells past the
+    // end of such a row are empty.
+    Row *row_items;
+    // Ragged tables keep their rows one after another in cells: the row
+    // `row` is cells[row_offsets[row] .. row_offsets[row + 1]] and all the
+    // cells past the end of a row are the single empty cell that follows
+    // the last row. NULL for rectangular tables. Only the row layout may be
+    // ragged.
+    size_t *row_offsets;
+    // Tables opened with an index (see --index) split a row into cells
+    // only once the row is accessed. The row `row` is the line
+    // content[line_offsets[row] .. line_offsets[row + 1]]. NULL when all
+    // the rows are loaded.
+    bool *rows_loaded;
+    const char *content;
+    const size_t *line_offsets;
+    // Number of the cells that copy their neighbor (see CELL_KIND_CLONE)
+    size_t clones;
 } Table;
 
+// Statistics of a run (--stats)
+
+typedef enum {
+    PHASE_READ = 0,
+    PHASE_INDEX,
+    PHASE_ESTIMATE,
+    PHASE_PARSE,
+    PHASE_LINK,
+    PHASE_CHECK,
+    PHASE_EVAL,
+    PHASE_OUTPUT,
+    PHASE_CACHE,
+    PHASE_PIPELINE,
+    COUNT_PHASES,
+} Phase;
+
+const char *phase_as_cstr(Phase phase)
+{
+    switch (phase) {
+    case PHASE_READ:
+        return "read";
+    case PHASE_ESTIMATE:
+        return "estimate";
+    case PHASE_PARSE:
+        return "parse";
+    case PHASE_LINK:
+        return "link";
+    case PHASE_CHECK:
+        return "check";
+    case PHASE_EVAL:
+        return "eval";
+    case PHASE_OUTPUT:
+        return "output";
+    case PHASE_PIPELINE:
+        return "pipeline";
+    case PHASE_INDEX:
+        return "index";
+    case PHASE_CACHE:
+        return "cache";
+    default:
+        assert(0 && "unreachable");
+        exit(1);
+    }
+}
+
+#define CELL_KINDS_COUNT 5
+
+// Hardware performance counters (--perf)
+//
+// The counters are opened with perf_event_open() for the whole process,
+// including the threads it starts later, and counted in user space only.
+// Any counter that cannot be opened (no PMU in a VM or container,
+// perf_event_paranoid, not Linux) is simply reported as unavailable.
+
+typedef enum {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    COUNT_PERF_COUNTERS,
+} Perf_Counter;
+
+const char *perf_counter_as_cstr(Perf_Counter counter)
+{
+    switch (counter) {
+    case PERF_CYCLES:
+        return "cycles";
+    case PERF_INSTRUCTIONS:
+        return "instructions";
+    case PERF_L1D_MISSES:
+        return "l1d_misses";
+    case PERF_LLC_MISSES:
+        return "llc_misses";
+    case PERF_BRANCH_MISSES:
+        return "branch_misses";
+    default:
+        assert(0 && "unreachable");
+        exit(1);
+    }
+}
+
+bool perf_enabled = false;
+int perf_fds[COUNT_PERF_COUNTERS];
+
+#ifdef MINICEL_PERF_EVENT
+int perf_open_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+// Returns the number of counters that could be opened
+size_t perf_open(void)
+{
+    size_t opened = 0;
+    for (size_t i = 0; i < COUNT_PERF_COUNTERS; ++i) {
+        perf_fds[i] = -1;
+    }
+
+#ifdef MINICEL_PERF_EVENT
+    const uint64_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D |
+                                   (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    perf_fds[PERF_CYCLES] = perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    perf_fds[PERF_INSTRUCTIONS] = perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    perf_fds[PERF_L1D_MISSES] = perf_open_counter(PERF_TYPE_HW_CACHE, l1d_read_miss);
+    perf_fds[PERF_LLC_MISSES] = perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    perf_fds[PERF_BRANCH_MISSES] = perf_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+    for (size_t i = 0; i < COUNT_PERF_COUNTERS; ++i) {
+        if (perf_fds[i] >= 0) {
+            opened += 1;
+        }
+    }
+#endif
+
+    return opened;
+}
+
+bool perf_available(Perf_Counter counter)
+{
+    return perf_enabled && perf_fds[counter] >= 0;
+}
+
+// Reads the counters scaled for the time they were multiplexed out
+void perf_read(uint64_t counters[COUNT_PERF_COUNTERS])
+{
+    for (size_t i = 0; i < COUNT_PERF_COUNTERS; ++i) {
+        counters[i] = 0;
+        if (!perf_available((Perf_Counter) i)) {
+            continue;
+        }
+
+        uint64_t value[3];
+        if (read(perf_fds[i], value, sizeof(value)) != (ssize_t) sizeof(value)) {
+            continue;
+        }
+        if (value[2] > 0 && value[2] < value[1]) {
+            counters[i] = (uint64_t) ((double) value[0] * (double) value[1] / (double) value[2]);
+        } else {
+            counters[i] = value[0];
+        }
+    }
+}
+
+void perf_close(void)
+{
+    for (size_t i = 0; i < COUNT_PERF_COUNTERS; ++i) {
+        if (perf_fds[i] >= 0) {
+            close(perf_fds[i]);
+            perf_fds[i] = -1;
+        }
+    }
+}
+
+typedef struct {
+    double secs;
+    uint64_t counters[COUNT_PERF_COUNTERS];
+} Phase_Start;
+
+typedef struct {
+    double phase_secs[COUNT_PHASES];
+    uint64_t phase_counters[COUNT_PHASES][COUNT_PERF_COUNTERS];
+    bool phase_ran[COUNT_PHASES];
+    size_t bytes_read;
+    size_t rows;
+    size_t cols;
+    const char *storage;
+    size_t stored_cells;
+    size_t cells[CELL_KINDS_COUNT];
+    size_t exprs;
+    size_t intern_lookups;
+    size_t intern_hits;
+    size_t eval_depth;
+    size_t max_eval_depth;
+    size_t vectorized_cells;
+    size_t cached_rows;
+    size_t pooled_texts;
+    size_t distinct_texts;
+    size_t text_pool_bytes;
+} Stats;
+
+Stats stats = {0};
+
+Cell *table_cell_at(Table *table, size_t row, size_t col);
+size_t table_cells_count(Table *table);
+
+uint64_t clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+double clock_secs(void)
+{
+    return (double) clock_ns() * 1e-9;
+}
+
+Phase_Start stats_phase_begin(void)
+{
+    Phase_Start start = {0};
+    if (perf_enabled) {
+        perf_read(start.counters);
+    }
+    start.secs = clock_secs();
+    return start;
+}
+
+void stats_phase_end(Phase phase, Phase_Start start)
+{
+    stats.phase_secs[phase] += clock_secs() - start.secs;
+    stats.phase_ran[phase] = true;
+
+    if (perf_enabled) {
+        uint64_t counters[COUNT_PERF_COUNTERS];
+        perf_read(counters);
+        for (size_t i = 0; i < COUNT_PERF_COUNTERS; ++i) {
+            stats.phase_counters[phase][i] += counters[i] - start.counters[i];
+        }
+    }
+}
+
+// Tracing (--trace)
+//
+// TRACE_BEGIN() and TRACE_END() record events into a buffer that belongs
+// to the calling thread, so recording never takes a lock. The first event
+// of a thread pushes its buffer onto a lock-free list, and the whole list
+// is dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) at
+// the end of the run, after all the threads are joined. Compile with
+// -DMINICEL_NO_TRACE to remove the trace points altogether.
+
+typedef struct {
+    const char *name;
+    uint64_t ns;
+    char phase;
+} Trace_Event;
+
+typedef struct Trace_Buffer Trace_Buffer;
+
+struct Trace_Buffer {
+    size_t count;
+    size_t capacity;
+    Trace_Event *items;
+    const char *thread_name;
+    size_t tid;
+    Trace_Buffer *next;
+};
+
+bool trace_enabled = false;
+uint64_t trace_start_ns = 0;
+_Atomic(Trace_Buffer *) trace_buffers = NULL;
+atomic_size_t trace_threads = 0;
+_Thread_local Trace_Buffer *trace_buffer = NULL;
+
+Trace_Buffer *trace_thread_buffer(void)
+{
+    if (trace_buffer == NULL) {
+        trace_buffer = malloc(sizeof(*trace_buffer));
+        memset(trace_buffer, 0, sizeof(*trace_buffer));
+        trace_buffer->tid = atomic_fetch_add(&trace_threads, 1) + 1;
+
+        Trace_Buffer *head = atomic_load(&trace_buffers);
+        do {
+            trace_buffer->next = head;
+        } while (!atomic_compare_exchange_weak(&trace_buffers, &head, trace_buffer));
+    }
+    return trace_buffer;
+}
+
+void trace_event(const char *name, char phase)
+{
+    Trace_Buffer *tb = trace_thread_buffer();
+    if (tb->count >= tb->capacity) {
+        tb->capacity = tb->capacity == 0 ? 256 : tb->capacity * 2;
+        tb->items = realloc(tb->items, sizeof(*tb->items) * tb->capacity);
+    }
+    tb->items[tb->count++] = (Trace_Event) {
+        .name = name,
+        .ns = clock_ns(),
+        .phase = phase,
+    };
+}
+
+void trace_thread_name(const char *name)
+{
+    trace_thread_buffer()->thread_name = name;
+}
+
+#ifndef MINICEL_NO_TRACE
+#    define TRACE_BEGIN(name) do { if (trace_enabled) trace_event((name), 'B'); } while (0)
+#    define TRACE_END(name) do { if (trace_enabled) trace_event((name), 'E'); } while (0)
+#    define TRACE_THREAD_NAME(name) do { if (trace_enabled) trace_thread_name(name); } while (0)
+#else
+#    define TRACE_BEGIN(name) do {} while (0)
+#    define TRACE_END(name) do {} while (0)
+#    define TRACE_THREAD_NAME(name) do {} while (0)
+#endif
+
+void trace_dump(FILE *stream)
+{
+    fprintf(stream, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    for (Trace_Buffer *tb = atomic_load(&trace_buffers); tb != NULL; tb = tb->next) {
+        if (tb->thread_name != NULL) {
+            fprintf(stream, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", tb->tid, tb->thread_name);
+            first = false;
+        }
+        for (size_t i = 0; i < tb->count; ++i) {
+            Trace_Event *e = &tb->items[i];
+            uint64_t ns = e->ns - trace_start_ns;
+            fprintf(stream, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03" PRIu64 ",\"pid\":1,\"tid\":%zu}",
+                    first ? "" : ",\n", e->name, e->phase, ns / 1000, ns % 1000, tb->tid);
+            first = false;
+        }
+    }
+    fprintf(stream, "\n]}\n");
+}
+
+void trace_free(void)
+{
+    Trace_Buffer *tb = atomic_exchange(&trace_buffers, NULL);
+    while (tb != NULL) {
+        Trace_Buffer *next = tb->next;
+        free(tb->items);
+        free(tb);
+        tb = next;
+    }
+}
+
+void stats_count_cells(Table *table)
+{
+    stats.rows = table->rows;
+    stats.cols = table->cols;
+    stats.storage = table->row_offsets ? "ragged" : layout_as_cstr(table->layout);
+    stats.stored_cells = table_cells_count(table);
+    for (size_t row = 0; row < table->rows; ++row) {
+        paged_tick(table->cols * sizeof(Cell));
+        // Counting the cells of a row that was never accessed would load it
+        if (table->rows_loaded && !table->rows_loaded[row]) {
+            continue;
+        }
+
+        size_t cols = table->row_items ? table->row_items[row].count : table->cols;
+        for (size_t col = 0; col < cols; ++col) {
+            stats.cells[table_cell_at(table, row, col)->kind] += 1;
+        }
+    }
+}
+
+// Errors in the input
+//
+// An error in the input is reported where it is found and ends the
+// program, except in watch mode: it sets input_error_recovery for the time
+// it loads or updates the table, keeps the last good table when that
+// fails and waits for the next change of the input. Watch mode checks the
+// input on a single thread.
+
+jmp_buf *input_error_recovery = NULL;
+
+_Noreturn void input_error(void)
+{
+    if (input_error_recovery != NULL) {
+        longjmp(*input_error_recovery, 1);
+    }
+    exit(1);
+}
+
 bool is_name(char c)
 {
     return isalnum(c) || c == '_';
@@ -136,9 +877,9 @@ String_View next_token(String_View *source)
         return sv_chop_left_while(source, is_name);
     }
 
-    fprintf(stderr, "ERROR: unknown token starts with `%c`",
+    fprintf(stderr, "ERROR: unknown token starts with `%c`\n",
             *source->data);
-    exit(1);
+    input_error();
 }
 
 typedef struct {
@@ -182,7 +923,7 @@ Expr_Index parse_primary_expr(String_View *source, Tmp_Cstr *tc, Expr_Buffer *eb
 
     if (token.count == 0) {
         fprintf(stderr, "ERROR: expected primary expression token, but got end of input\n");
-        exit(1);
+        input_error();
     }
 
     Expr_Index expr_index = expr_buffer_alloc(eb);
@@ -197,7 +938,7 @@ Expr_Index parse_primary_expr(String_View *source, Tmp_Cstr *tc, Expr_Buffer *eb
 
         if (!isupper(*token.data)) {
             fprintf(stderr, "ERROR: cell reference must start with capital letter\n");
-            exit(1);
+            input_error();
         }
 
         expr->as.cell.col = *token.data - 'A';
@@ -207,7 +948,7 @@ Expr_Index parse_primary_expr(String_View *source, Tmp_Cstr *tc, Expr_Buffer *eb
         long int row = 0;
         if (!sv_strtol(token, tc, &row)) {
             fprintf(stderr, "ERROR: cell reference must have an integer as the row number\n");
-            exit(1);
+            input_error();
         }
 
         expr->as.cell.row = (size_t) row;
@@ -252,6 +993,14 @@ void dump_expr(FILE *stream, Expr_Buffer *eb, Expr_Index expr_index, int level)
         fprintf(stream, "CELL(%zu, %zu)\n", expr->as.cell.row, expr->as.cell.col);
         break;
 
+    case EXPR_KIND_REL_CELL:
+        fprintf(stream, "REL_CELL(%td, %td)\n", expr->as.rel_cell.drow, expr->as.rel_cell.dcol);
+        break;
+
+    case EXPR_KIND_CELL_INDEX:
+        fprintf(stream, "CELL_INDEX(%zu)\n", expr->as.cell_index);
+        break;
+
     case EXPR_KIND_PLUS:
         fprintf(stream, "PLUS:\n");
         dump_expr(stream, eb, expr->as.plus.lhs, level + 1);
@@ -265,241 +1014,5776 @@ Expr_Index parse_expr(String_View *source, Tmp_Cstr *tc, Expr_Buffer *eb)
     return parse_plus_expr(source, tc, eb);
 }
 
-Cell *table_cell_at(Table *table, size_t row, size_t col)
+// Index of the cell (row, col) in table->cells
+size_t table_cell_index(Table *table, size_t row, size_t col)
 {
     assert(row < table->rows);
     assert(col < table->cols);
-    return &table->cells[row * table->cols + col];
-}
-
-void usage(FILE *stream)
-{
-    fprintf(stream, "Usage: ./minicel <input.csv>\n");
-}
-
-char *slurp_file(const char *file_path, size_t *size)
-{
-    char *buffer = NULL;
-
-    FILE *f = fopen(file_path, "rb");
-    if (f == NULL) {
-        goto error;
-    }
 
-    if (fseek(f, 0, SEEK_END) < 0) {
-        goto error;
+    if (table->row_offsets) {
+        size_t index = table->row_offsets[row] + col;
+        return index < table->row_offsets[row + 1] ? index : table->row_offsets[table->rows];
     }
 
-    long m = ftell(f);
-    if (m < 0) {
-        goto error;
+    switch (table->layout) {
+    case LAYOUT_ROWS:
+        return row * table->cols + col;
+    case LAYOUT_COLUMNS:
+        return col * table->rows + row;
+    case LAYOUT_TILES: {
+        size_t tile_cols = (table->cols + TILE_SIZE - 1) / TILE_SIZE;
+        size_t tile = row / TILE_SIZE * tile_cols + col / TILE_SIZE;
+        return tile * TILE_SIZE * TILE_SIZE + row % TILE_SIZE * TILE_SIZE + col % TILE_SIZE;
     }
+    default:
+        assert(0 && "unreachable");
+        exit(1);
+    }
+}
 
-    buffer = malloc(sizeof(char) * m);
-    if (buffer == NULL) {
-        goto error;
+// Position of the cell table->cells[index]
+void table_cell_position(Table *table, size_t index, size_t *out_row, size_t *out_col)
+{
+    if (table->row_offsets) {
+        assert(index < table->row_offsets[table->rows]);
+        // The last row that starts at or before the index
+        size_t lo = 0;
+        size_t hi = table->rows;
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (table->row_offsets[mid] <= index) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        *out_row = lo;
+        *out_col = index - table->row_offsets[lo];
+        return;
     }
 
-    if (fseek(f, 0, SEEK_SET) < 0) {
-        goto error;
+    switch (table->layout) {
+    case LAYOUT_ROWS:
+        *out_row = index / table->cols;
+        *out_col = index % table->cols;
+        break;
+    case LAYOUT_COLUMNS:
+        *out_row = index % table->rows;
+        *out_col = index / table->rows;
+        break;
+    case LAYOUT_TILES: {
+        size_t tile_cols = (table->cols + TILE_SIZE - 1) / TILE_SIZE;
+        size_t tile = index / (TILE_SIZE * TILE_SIZE);
+        size_t offset = index % (TILE_SIZE * TILE_SIZE);
+        *out_row = tile / tile_cols * TILE_SIZE + offset / TILE_SIZE;
+        *out_col = tile % tile_cols * TILE_SIZE + offset % TILE_SIZE;
+    }
+    break;
+    default:
+        assert(0 && "unreachable");
+        exit(1);
     }
+}
 
-    size_t n = fread(buffer, 1, m, f);
-    assert(n == (size_t) m);
+// Number of the cells in table->cells, not counting the empty cell of the
+// ragged tables
+size_t table_cells_count(Table *table)
+{
+    if (table->row_offsets) {
+        return table->row_offsets[table->rows];
+    }
 
-    if (ferror(f)) {
-        goto error;
+    if (table->layout == LAYOUT_TILES) {
+        size_t tile_rows = (table->rows + TILE_SIZE - 1) / TILE_SIZE;
+        size_t tile_cols = (table->cols + TILE_SIZE - 1) / TILE_SIZE;
+        return tile_rows * tile_cols * TILE_SIZE * TILE_SIZE;
     }
 
-    if (size) {
-        *size = n;
+    return table->rows * table->cols;
+}
+
+void table_load_row(Table *table, size_t row);
+
+Cell *table_cell_at(Table *table, size_t row, size_t col)
+{
+    assert(row < table->rows);
+
+    if (table->rows_loaded && !table->rows_loaded[row]) {
+        table_load_row(table, row);
     }
 
-    fclose(f);
+    if (table->row_items) {
+        static Cell empty = {0};
+        if (col >= table->row_items[row].count) {
+            return &empty;
+        }
+        return &table->row_items[row].cells[col];
+    }
 
-    return buffer;
+    return &table->cells[table_cell_index(table, row, col)];
+}
 
-error:
-    if (f) {
-        fclose(f);
+void usage(FILE *stream)
+{
+    fprintf(stream, "Usage: ./minicel [OPTIONS] <input.csv>\n");
+    fprintf(stream, "OPTIONS:\n");
+    fprintf(stream, "    -o <output>    write the result into <output> instead of stdout\n");
+    fprintf(stream, "    --arrow        output the evaluated table as an Arrow IPC stream\n");
+    fprintf(stream, "    -j <jobs>      use up to <jobs> threads (default: 1)\n");
+    fprintf(stream, "    --pipeline     read, parse, evaluate and write the rows concurrently\n");
+    fprintf(stream, "    --no-io-uring  read the input with pread() instead of io_uring\n");
+    fprintf(stream, "    --no-vectorize evaluate the copied formulas one cell at a time\n");
+    fprintf(stream, "    --lazy         parse the formulas only once they are evaluated\n");
+    fprintf(stream, "    --index        keep the row offsets in <input.csv>.idx and map the input\n");
+    fprintf(stream, "    --watch        evaluate the input again every time it changes\n");
+    fprintf(stream, "    --text-pool    copy the texts out of the input and release it after parsing\n");
+    fprintf(stream, "    --cache <dir>  reuse the values of the unchanged rows from earlier runs\n");
+    fprintf(stream, "    --cache-limit <size>\n");
+    fprintf(stream, "                   keep the cache under <size> like 64M (default: 256M)\n");
+    fprintf(stream, "    --max-memory <size>\n");
+    fprintf(stream, "                   keep the table in temporary files and the RSS under <size>\n");
+    fprintf(stream, "    --columns <columns>\n");
+    fprintf(stream, "                   evaluate and output only the columns like A,C or C:E\n");
+    fprintf(stream, "    --cells <cells>\n");
+    fprintf(stream, "                   evaluate and output only the cells like A5,C10 or A1:B3\n");
+    fprintf(stream, "    --layout=<rows|columns|tiles>\n");
+    fprintf(stream, "                   order of the cells in memory (default: rows)\n");
+    fprintf(stream, "    --stats[=json] report the time of every phase and other counters to stderr\n");
+    fprintf(stream, "    --perf         add hardware performance counters to the --stats report\n");
+    fprintf(stream, "    --trace <file> save a Chrome trace of the run into <file>\n");
+    fprintf(stream, "    --profile[=N]  report the N most expensive formulas to stderr (default: 10)\n");
+    fprintf(stream, "    --help         print this help and exit\n");
+}
+
+char *shift_args(int *argc, char ***argv)
+{
+    assert(*argc > 0);
+    char *result = **argv;
+    *argc -= 1;
+    *argv += 1;
+    return result;
+}
+
+// Asynchronous input
+//
+// The input is read in large blocks with READ_AHEAD reads in flight at
+// consecutive offsets, so the device keeps working while the blocks that
+// are already there are being parsed. On Linux the reads go through
+// io_uring. When io_uring is not available (other systems, old kernels,
+// seccomp filters in containers, --no-io-uring) the blocks are read one
+// by one with pread().
+
+#define READ_AHEAD 4
+#define READ_BLOCK_SIZE (1024 * 1024)
+
+bool use_io_uring = true;
+
+#ifdef MINICEL_IO_URING
+typedef struct {
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+} Uring;
+
+void uring_destroy(Uring *u)
+{
+    if (u->sqes != NULL && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED) munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED) munmap(u->sq_ring, u->sq_ring_size);
+    close(u->fd);
+    memset(u, 0, sizeof(*u));
+}
+
+bool uring_init(Uring *u, unsigned entries)
+{
+    memset(u, 0, sizeof(*u));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    u->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (u->fd < 0) {
+        return false;
     }
 
-    if (buffer) {
-        free(buffer);
+    u->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->fd, IORING_OFF_SQ_RING);
+    u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        uring_destroy(u);
+        return false;
     }
 
-    return NULL;
+    char *sq = u->sq_ring;
+    u->sq_head = (unsigned *) (sq + params.sq_off.head);
+    u->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    u->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    u->sq_array = (unsigned *) (sq + params.sq_off.array);
+
+    char *cq = u->cq_ring;
+    u->cq_head = (unsigned *) (cq + params.cq_off.head);
+    u->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    u->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return true;
 }
 
-void parse_table_from_content(Table *table, Expr_Buffer *eb, Tmp_Cstr *tc, String_View content)
+void uring_prep_readv(Uring *u, int fd, struct iovec *iov, off_t offset, uint64_t user_data)
 {
-    for (size_t row = 0; content.count > 0; ++row) {
-        String_View line = sv_chop_by_delim(&content, '\n');
-        for (size_t col = 0; line.count > 0; ++col) {
-            String_View cell_value = sv_trim(sv_chop_by_delim(&line, '|'));
-            Cell *cell = table_cell_at(table, row, col);
+    unsigned tail = *u->sq_tail;
+    unsigned index = tail & *u->sq_mask;
 
-            if (sv_starts_with(cell_value, SV("="))) {
-                sv_chop_left(&cell_value, 1);
-                cell->kind = CELL_KIND_EXPR;
-                cell->as.expr.index = parse_expr(&cell_value, tc, eb);
-            } else {
-                if (sv_strtod(cell_value, tc, &cell->as.number)) {
-                    cell->kind = CELL_KIND_NUMBER;
-                } else {
-                    cell->kind = CELL_KIND_TEXT;
-                    cell->as.text = cell_value;
-                }
-            }
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) iov;
+    sqe->len = 1;
+    sqe->off = (uint64_t) offset;
+    sqe->user_data = user_data;
+
+    u->sq_array[index] = index;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit += 1;
+}
+
+// Submits everything that was prepared and waits for at least one completion
+void uring_submit_and_wait(Uring *u)
+{
+    for (;;) {
+        int n = (int) syscall(__NR_io_uring_enter, u->fd, u->to_submit, 1,
+                              IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0) {
+            u->to_submit -= (unsigned) n;
+            return;
+        }
+        if (errno != EINTR && errno != EAGAIN) {
+            fprintf(stderr, "ERROR: io_uring_enter failed: %s\n", strerror(errno));
+            exit(1);
         }
     }
 }
 
-void estimate_table_size(String_View content, size_t *out_rows, size_t *out_cols)
+bool uring_pop(Uring *u, struct io_uring_cqe *cqe)
 {
-    size_t rows = 0;
-    size_t cols = 0;
-    for (; content.count > 0; ++rows) {
-        String_View line = sv_chop_by_delim(&content, '\n');
-        size_t col = 0;
-        for (; line.count > 0; ++col) {
-            sv_chop_by_delim(&line, '|');
-        }
+    unsigned head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *cqe = u->cqes[head & *u->cq_mask];
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+#endif // MINICEL_IO_URING
 
-        if (cols < col) {
-            cols = col;
+typedef struct {
+    char *buffer;
+    size_t count;
+    size_t want;
+    off_t offset;
+    struct iovec iov;
+} Read_Slot;
+
+// Hands out the blocks of a file in order. Every block is a separate
+// allocation with `headroom` free bytes in front of the data, so the
+// caller can glue the unfinished line of the previous block to it.
+typedef struct {
+    int fd;
+    size_t headroom;
+    off_t size;
+    off_t submitted;
+    size_t next;
+    size_t pending;
+    Read_Slot slots[READ_AHEAD];
+#ifdef MINICEL_IO_URING
+    bool async;
+    Uring uring;
+#endif
+} Block_Reader;
+
+void block_reader_open(Block_Reader *r, int fd, size_t headroom)
+{
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->headroom = headroom;
+
+    struct stat st;
+    bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    r->size = regular ? st.st_size : -1;
+
+#ifdef __linux__
+    if (regular) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+
+#ifdef MINICEL_IO_URING
+    r->async = regular && use_io_uring && uring_init(&r->uring, READ_AHEAD);
+#endif
+}
+
+void block_reader_close(Block_Reader *r)
+{
+    for (size_t i = 0; i < READ_AHEAD; ++i) {
+        free(r->slots[i].buffer);
+    }
+#ifdef MINICEL_IO_URING
+    if (r->async) {
+        uring_destroy(&r->uring);
+    }
+#endif
+}
+
+#ifdef MINICEL_IO_URING
+void block_reader_submit(Block_Reader *r, size_t index)
+{
+    Read_Slot *slot = &r->slots[index];
+    slot->iov.iov_base = slot->buffer + r->headroom + slot->count;
+    slot->iov.iov_len = slot->want - slot->count;
+    uring_prep_readv(&r->uring, r->fd, &slot->iov, slot->offset + (off_t) slot->count, index);
+}
+
+char *block_reader_next_async(Block_Reader *r, size_t *count)
+{
+    while (r->pending < READ_AHEAD && r->submitted < r->size) {
+        size_t index = (r->next + r->pending) % READ_AHEAD;
+        Read_Slot *slot = &r->slots[index];
+        slot->offset = r->submitted;
+        slot->want = READ_BLOCK_SIZE;
+        if ((off_t) slot->want > r->size - r->submitted) {
+            slot->want = (size_t) (r->size - r->submitted);
         }
+        slot->count = 0;
+        slot->buffer = malloc(r->headroom + slot->want);
+        block_reader_submit(r, index);
+        r->submitted += (off_t) slot->want;
+        r->pending += 1;
     }
 
-    if (out_rows) {
-        *out_rows = rows;
+    if (r->pending == 0) {
+        *count = 0;
+        return malloc(r->headroom);
     }
 
-    if (out_cols) {
-        *out_cols = cols;
+    Read_Slot *slot = &r->slots[r->next % READ_AHEAD];
+    while (slot->count < slot->want) {
+        uring_submit_and_wait(&r->uring);
+
+        struct io_uring_cqe cqe;
+        while (uring_pop(&r->uring, &cqe)) {
+            Read_Slot *done = &r->slots[cqe.user_data];
+            if (cqe.res < 0) {
+                fprintf(stderr, "ERROR: could not read the input: %s\n", strerror(-cqe.res));
+                exit(1);
+            }
+            if (cqe.res == 0) {
+                // The file got shorter since we looked at it
+                done->want = done->count;
+                continue;
+            }
+            done->count += (size_t) cqe.res;
+            if (done->count < done->want) {
+                block_reader_submit(r, (size_t) cqe.user_data);
+            }
+        }
     }
+
+    char *buffer = slot->buffer;
+    *count = slot->count;
+    slot->buffer = NULL;
+    r->next += 1;
+    r->pending -= 1;
+    return buffer;
 }
+#endif // MINICEL_IO_URING
+
+// Returns the next block of the file. The data starts at `headroom` bytes
+// into the returned buffer, which is owned by the caller. `*count` is 0
+// at the end of the file.
+char *block_reader_next(Block_Reader *r, size_t *count)
+{
+#ifdef MINICEL_IO_URING
+    if (r->async) {
+        return block_reader_next_async(r, count);
+    }
+#endif
+
+    char *buffer = malloc(r->headroom + READ_BLOCK_SIZE);
+    size_t n = 0;
+    while (n < READ_BLOCK_SIZE) {
+        ssize_t m = r->size >= 0
+            ? pread(r->fd, buffer + r->headroom + n, READ_BLOCK_SIZE - n, r->submitted)
+            : read(r->fd, buffer + r->headroom + n, READ_BLOCK_SIZE - n);
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ERROR: could not read the input: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (m == 0) {
+            break;
+        }
+        n += (size_t) m;
+        r->submitted += m;
+    }
 
-void table_eval_cell(Table *table, Expr_Buffer *eb, Cell *cell);
+    *count = n;
+    return buffer;
+}
 
-double table_eval_expr(Table *table, Expr_Buffer *eb, Expr_Index expr_index)
+// Reads `size` bytes from the beginning of a regular file into `buffer`
+bool read_file_into(int fd, char *buffer, size_t size)
 {
-    Expr *expr = expr_buffer_at(eb, expr_index);
+#ifdef MINICEL_IO_URING
+    Uring u;
+    if (use_io_uring && uring_init(&u, READ_AHEAD)) {
+        Read_Slot slots[READ_AHEAD];
+        size_t submitted = 0;
+        size_t pending = 0;
+        size_t done = 0;
 
-    switch (expr->kind) {
-    case EXPR_KIND_NUMBER:
-        return expr->as.number;
+        while (done < size) {
+            for (size_t i = 0; i < READ_AHEAD && submitted < size; ++i) {
+                if (pending & ((size_t) 1 << i)) continue;
+                Read_Slot *slot = &slots[i];
+                slot->offset = (off_t) submitted;
+                slot->want = size - submitted < READ_BLOCK_SIZE ? size - submitted : READ_BLOCK_SIZE;
+                slot->count = 0;
+                slot->iov.iov_base = buffer + submitted;
+                slot->iov.iov_len = slot->want;
+                uring_prep_readv(&u, fd, &slot->iov, slot->offset, i);
+                submitted += slot->want;
+                pending |= (size_t) 1 << i;
+            }
 
-    case EXPR_KIND_CELL: {
-        Cell *cell = table_cell_at(table, expr->as.cell.row, expr->as.cell.col);
-        switch (cell->kind) {
-        case CELL_KIND_NUMBER:
-            return cell->as.number;
-        case CELL_KIND_TEXT: {
-            fprintf(stderr, "ERROR: text cells may not participate in math expressions\n");
-            exit(1);
+            uring_submit_and_wait(&u);
+
+            struct io_uring_cqe cqe;
+            while (uring_pop(&u, &cqe)) {
+                Read_Slot *slot = &slots[cqe.user_data];
+                if (cqe.res <= 0) {
+                    errno = cqe.res < 0 ? -cqe.res : EIO;
+                    uring_destroy(&u);
+                    return false;
+                }
+                slot->count += (size_t) cqe.res;
+                done += (size_t) cqe.res;
+                if (slot->count < slot->want) {
+                    slot->iov.iov_base = buffer + slot->offset + slot->count;
+                    slot->iov.iov_len = slot->want - slot->count;
+                    uring_prep_readv(&u, fd, &slot->iov, slot->offset + (off_t) slot->count, cqe.user_data);
+                } else {
+                    pending &= ~((size_t) 1 << cqe.user_data);
+                }
+            }
         }
-        break;
 
-        case CELL_KIND_EXPR: {
-            table_eval_cell(table, eb, cell);
-            return cell->as.expr.value;
+        uring_destroy(&u);
+        return true;
+    }
+#endif
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, buffer + done, size - done, (off_t) done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
         }
-        break;
+        if (n == 0) {
+            errno = EIO;
+            return false;
         }
+        done += (size_t) n;
     }
-    break;
+    return true;
+}
 
-    case EXPR_KIND_PLUS: {
-        double lhs = table_eval_expr(table, eb, expr->as.plus.lhs);
-        double rhs = table_eval_expr(table, eb, expr->as.plus.rhs);
-        return lhs + rhs;
+char *slurp_file(const char *file_path, size_t *size)
+{
+    char *buffer = NULL;
+
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        goto error;
     }
-    break;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        goto error;
     }
-    return 0;
+
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    size_t m = (size_t) st.st_size;
+    buffer = malloc(sizeof(char) * (m > 0 ? m : 1));
+    if (buffer == NULL) {
+        goto error;
+    }
+
+#ifdef __linux__
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (!read_file_into(fd, buffer, m)) {
+        goto error;
+    }
+
+    if (size) {
+        *size = m;
+    }
+
+    close(fd);
+
+    return buffer;
+
+error:
+    if (fd >= 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+
+    if (buffer) {
+        free(buffer);
+    }
+
+    return NULL;
 }
 
-void table_eval_cell(Table *table, Expr_Buffer *eb, Cell *cell)
+// Maps a regular file into memory read only. Unlike slurp_file() only the
+// pages that are actually accessed are ever read.
+char *map_file(const char *file_path, size_t *size)
 {
-    if (cell->kind == CELL_KIND_EXPR) {
-        if (cell->as.expr.status == INPROGRESS) {
-            fprintf(stderr, "ERROR: circular dependency is detected!\n");
-            exit(1);
-        }
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
 
-        if (cell->as.expr.status == UNEVALUATED) {
-            cell->as.expr.status = INPROGRESS;
-            cell->as.expr.value = table_eval_expr(table, eb, cell->as.expr.index);
-            cell->as.expr.status = EVALUATED;
+    size_t m = (size_t) st.st_size;
+    // mmap() refuses empty mappings
+    char *data = "";
+    if (m > 0) {
+        data = mmap(NULL, m, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return NULL;
         }
     }
-}
+    close(fd);
 
-// TODO(#7): syntax for copying expression from a neighbor cell
+    if (size) {
+        *size = m;
+    }
+    return data;
+}
 
-int main(int argc, char **argv)
+void unmap_file(char *data, size_t size)
 {
-    if (argc < 2) {
-        usage(stderr);
-        fprintf(stderr, "ERROR: input file is not provided\n");
-        exit(1);
+    if (size > 0) {
+        munmap(data, size);
     }
+}
 
-    const char *input_file_path = argv[1];
-
-    size_t content_size = 0;
-    char *content = slurp_file(input_file_path, &content_size);
-    if (content == NULL) {
-        fprintf(stderr, "ERROR: could not read file %s: %s\n",
-                input_file_path, strerror(errno));
-        exit(1);
+// Frees the input of main(), which is `mapped` with --index and
+// --max-memory and read into the heap otherwise
+void free_input(char *content, size_t size, bool mapped)
+{
+    if (!mapped) {
+        free(content);
+    } else if (max_memory > 0 && size > 0) {
+        paged_free(content);
+    } else {
+        unmap_file(content, size);
     }
+}
 
-    String_View input = {
-        .count = content_size,
-        .data = content,
-    };
+// Quoted fields
+//
+// A field may be put in double quotes to hold `|`, newlines and quotes,
+// the latter written twice (""), like in RFC 4180. The scanner below
+// opens or closes the quoted part at any quote, so a quote in the middle
+// of a field that is not quoted as a whole would hide the delimiters that
+// follow it. parse_cell() reports such fields with csv_field_is_valid().
+//
+// The delimiters are searched for 64 bytes at a time. The bit masks of
+// the quotes and of the delimiters in a block come from SIMD compares,
+// the prefix XOR of the quotes marks the bytes inside of the quotes, and
+// the first delimiter outside of them is the lowest bit that is left.
+// Only the state at the end of a block carries over to the next one, so
+// the long lines and quoted texts are never walked byte by byte. The
+// bytes that are left after the last whole block are.
 
-    Expr_Buffer eb = {0};
-    Table table = {0};
-    Tmp_Cstr tc = {0};
+#define CSV_BLOCK_SIZE 64
+
+// Bit `i` is set when block[i] == c
+uint64_t csv_block_mask(const char *block, char c)
+{
+    uint64_t mask = 0;
+#if defined(__SSE2__)
+    __m128i needle = _mm_set1_epi8(c);
+    for (size_t i = 0; i < CSV_BLOCK_SIZE; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (block + i));
+        uint64_t bits = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, needle));
+        mask |= bits << i;
+    }
+#else
+    for (size_t i = 0; i < CSV_BLOCK_SIZE; ++i) {
+        mask |= (uint64_t) (block[i] == c) << i;
+    }
+#endif
+    return mask;
+}
 
-    estimate_table_size(input, &table.rows, &table.cols);
-    table.cells = malloc(sizeof(*table.cells) * table.rows * table.cols);
-    memset(table.cells, 0, sizeof(*table.cells) * table.rows * table.cols);
-    parse_table_from_content(&table, &eb, &tc, input);
+// Bit `i` of the result is the XOR of the bits 0..i of the mask
+uint64_t csv_prefix_xor(uint64_t mask)
+{
+    mask ^= mask << 1;
+    mask ^= mask << 2;
+    mask ^= mask << 4;
+    mask ^= mask << 8;
+    mask ^= mask << 16;
+    mask ^= mask << 32;
+    return mask;
+}
 
-    for (size_t row = 0; row < table.rows; ++row) {
-        for (size_t col = 0; col < table.cols; ++col) {
-            Cell *cell = table_cell_at(&table, row, col);
-            table_eval_cell(&table, &eb, cell);
+// Same as sv_index_of(), but skips the `delim`s inside of the quotes
+bool csv_index_of(String_View sv, char delim, size_t *index)
+{
+    // All ones while inside of the quotes
+    uint64_t inside = 0;
+    size_t begin = 0;
+    for (; begin + CSV_BLOCK_SIZE <= sv.count; begin += CSV_BLOCK_SIZE) {
+        const char *block = sv.data + begin;
+        uint64_t quotes = csv_block_mask(block, '"');
+        uint64_t delims = csv_block_mask(block, delim);
+        if (quotes != 0 || inside != 0) {
+            uint64_t quoted = csv_prefix_xor(quotes) ^ inside;
+            delims &= ~quoted;
+            inside = 0 - (quoted >> 63);
+        }
 
-            switch (cell->kind) {
-            case CELL_KIND_TEXT:
-                printf(SV_Fmt, SV_Arg(cell->as.text));
-                break;
+        if (delims != 0) {
+            *index = begin + (size_t) __builtin_ctzll(delims);
+            return true;
+        }
+    }
 
-            case CELL_KIND_NUMBER:
-                printf("%lf", cell->as.number);
-                break;
+    // The bytes past the last whole block, which is all of most of the
+    // fields
+    for (size_t i = begin; i < sv.count; ++i) {
+        if (sv.data[i] == '"') {
+            inside = ~inside;
+        } else if (sv.data[i] == delim && inside == 0) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
 
-            case CELL_KIND_EXPR:
-                printf("%lf", cell->as.expr.value);
-                break;
-            }
+// A field without quotes, or a field in quotes as a whole with every quote
+// inside of it written twice
+bool csv_field_is_valid(String_View field)
+{
+    if (memchr(field.data, '"', field.count) == NULL) {
+        return true;
+    }
 
-            if (col < table.cols - 1) {
-                printf("|");
+    if (field.count < 2 || field.data[0] != '"' || field.data[field.count - 1] != '"') {
+        return false;
+    }
+    for (size_t i = 1; i + 1 < field.count; ++i) {
+        if (field.data[i] == '"') {
+            if (i + 2 >= field.count || field.data[i + 1] != '"') {
+                return false;
             }
+            i += 1;
         }
-        printf("\n");
     }
+    return true;
+}
 
-    free(content);
-    free(table.cells);
-    free(eb.items);
-    free(tc.cstr);
+// Same as sv_chop_by_delim(), but skips the `delim`s inside of the quotes
+String_View csv_chop_by_delim(String_View *sv, char delim)
+{
+    size_t i = sv->count;
+    bool found = csv_index_of(*sv, delim, &i);
+
+    String_View result = {
+        .count = i,
+        .data = sv->data,
+    };
+    sv->count -= i + found;
+    sv->data += i + found;
+    return result;
+}
+
+void parse_cell(Cell *cell, Expr_Buffer *eb, Tmp_Cstr *tc, String_View cell_value)
+{
+    if (!csv_field_is_valid(cell_value)) {
+        // The field may have swallowed the rest of the input
+        String_View shown = cell_value;
+        size_t newline = 0;
+        if (sv_index_of(shown, '\n', &newline)) {
+            shown.count = newline;
+        }
+        if (shown.count > 64) {
+            shown.count = 64;
+        }
+        fprintf(stderr, "ERROR: unexpected quote in the field `"SV_Fmt"%s`. A field with quotes has to be quoted as a whole, with the quotes inside of it written twice\n",
+                SV_Arg(shown), shown.count < cell_value.count ? "..." : "");
+        input_error();
+    }
+
+    if (sv_starts_with(cell_value, SV("="))) {
+        sv_chop_left(&cell_value, 1);
+        cell->kind = CELL_KIND_EXPR;
+        cell->index = parse_expr(&cell_value, tc, eb);
+    } else if (sv_starts_with(cell_value, SV(":"))) {
+        sv_chop_left(&cell_value, 1);
+        cell->kind = CELL_KIND_CLONE;
+        if (sv_eq(cell_value, SV("<"))) {
+            cell->dir = DIR_LEFT;
+        } else if (sv_eq(cell_value, SV(">"))) {
+            cell->dir = DIR_RIGHT;
+        } else if (sv_eq(cell_value, SV("^"))) {
+            cell->dir = DIR_UP;
+        } else if (sv_eq(cell_value, SV("v"))) {
+            cell->dir = DIR_DOWN;
+        } else {
+            fprintf(stderr, "ERROR: unknown copy direction `"SV_Fmt"`. Expected one of <, >, ^, v\n",
+                    SV_Arg(cell_value));
+            input_error();
+        }
+    } else {
+        if (sv_strtod(cell_value, tc, &cell->number)) {
+            cell->kind = CELL_KIND_NUMBER;
+        } else {
+            cell->kind = CELL_KIND_TEXT;
+            cell_set_text(cell, cell_value);
+        }
+    }
+}
+
+// Formula interning
+//
+// The same formula text often repeats many times in a sheet (totals that
+// refer to the same cells, duplicated lookups). The formulas are parsed
+// once per distinct text and the cells share the resulting expression,
+// which is fine since the expressions are never modified after parsing.
+
+typedef struct {
+    String_View text;
+    Expr_Index index;
+} Intern_Slot;
+
+// Open addressing hash table of the formula texts
+typedef struct {
+    // A slot with text.data == NULL is free
+    Intern_Slot *slots;
+    size_t count;
+    size_t capacity;
+} Intern_Table;
+
+uint64_t intern_hash(String_View text)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < text.count; ++i) {
+        hash ^= (unsigned char) text.data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+Intern_Slot *intern_find(Intern_Table *it, String_View text)
+{
+    assert(it->capacity > 0 && (it->capacity & (it->capacity - 1)) == 0);
+    size_t mask = it->capacity - 1;
+    size_t i = (size_t) intern_hash(text) & mask;
+    while (it->slots[i].text.data != NULL && !sv_eq(it->slots[i].text, text)) {
+        i = (i + 1) & mask;
+    }
+    return &it->slots[i];
+}
+
+void intern_grow(Intern_Table *it)
+{
+    Intern_Table grown = {0};
+    grown.capacity = it->capacity == 0 ? 256 : it->capacity * 2;
+    grown.slots = paged_calloc(grown.capacity, sizeof(*grown.slots));
+    assert(grown.slots != NULL && "Buy more RAM lol");
+
+    for (size_t i = 0; i < it->capacity; ++i) {
+        paged_tick(sizeof(*it->slots));
+        if (it->slots[i].text.data != NULL) {
+            *intern_find(&grown, it->slots[i].text) = it->slots[i];
+            grown.count += 1;
+        }
+    }
+
+    paged_free(it->slots);
+    *it = grown;
+}
+
+void intern_free(Intern_Table *it)
+{
+    paged_free(it->slots);
+    memset(it, 0, sizeof(*it));
+}
+
+// With `lazy` the formulas are only parsed once they are needed for the
+// evaluation (see --cells and --lazy). The cells of the columns that are
+// not `projected` are not parsed at all until they are needed (see
+// --columns), NULL projects all the columns. The cells of the `cached`
+// rows are only split and left for cache_fill() (see --cache), NULL
+// parses all the rows.
+void parse_table_from_content(Table *table, Expr_Buffer *eb, Tmp_Cstr *tc, String_View content, bool lazy,
+                              const bool *projected, const bool *cached)
+{
+    Intern_Table interns = {0};
+    size_t index = 0;
+
+    for (size_t row = 0; content.count > 0; ++row) {
+        String_View line = csv_chop_by_delim(&content, '\n');
+        paged_tick(line.count + table->cols * sizeof(Cell));
+        if (table->row_offsets) {
+            table->row_offsets[row] = index;
+        }
+        for (size_t col = 0; line.count > 0; ++col, ++index) {
+            String_View cell_value = sv_trim(csv_chop_by_delim(&line, '|'));
+            // The ends of the rows of a ragged table are only known once
+            // the rows are parsed
+            Cell *cell = table->row_offsets ? &table->cells[index] : table_cell_at(table, row, col);
+
+            if ((projected && !projected[col]) || (cached && cached[row])) {
+                cell->kind = CELL_KIND_RAW;
+                cell_set_text(cell, cell_value);
+                continue;
+            }
+
+            if (lazy && sv_starts_with(cell_value, SV("="))) {
+                sv_chop_left(&cell_value, 1);
+                cell->kind = CELL_KIND_EXPR;
+                cell_set_source(cell, cell_value);
+                cell->status = UNPARSED;
+                continue;
+            }
+
+            if (sv_starts_with(cell_value, SV("="))) {
+                if (interns.count * 4 >= interns.capacity * 3) {
+                    intern_grow(&interns);
+                }
+
+                stats.intern_lookups += 1;
+                Intern_Slot *slot = intern_find(&interns, cell_value);
+                if (slot->text.data != NULL) {
+                    stats.intern_hits += 1;
+                    cell->kind = CELL_KIND_EXPR;
+                    cell->index = slot->index;
+                    continue;
+                }
+
+                parse_cell(cell, eb, tc, cell_value);
+                slot->text = cell_value;
+                slot->index = cell->index;
+                interns.count += 1;
+                continue;
+            }
+
+            parse_cell(cell, eb, tc, cell_value);
+            if (cell->kind == CELL_KIND_CLONE) {
+                table->clones += 1;
+            }
+        }
+    }
+
+    if (table->row_offsets) {
+        table->row_offsets[table->rows] = index;
+    }
+
+    intern_free(&interns);
+}
+
+// The number of the cells is the sum of the lengths of all the rows,
+// which is less than rows * cols when the rows differ in length
+void estimate_table_size(String_View content, size_t *out_rows, size_t *out_cols, size_t *out_cells)
+{
+    size_t rows = 0;
+    size_t cols = 0;
+    size_t cells = 0;
+    for (; content.count > 0; ++rows) {
+        String_View line = csv_chop_by_delim(&content, '\n');
+        paged_tick(line.count);
+        size_t col = 0;
+        for (; line.count > 0; ++col) {
+            csv_chop_by_delim(&line, '|');
+        }
+
+        if (cols < col) {
+            cols = col;
+        }
+        cells += col;
+    }
+
+    if (out_rows) {
+        *out_rows = rows;
+    }
+
+    if (out_cols) {
+        *out_cols = cols;
+    }
+
+    if (out_cells) {
+        *out_cells = cells;
+    }
+}
+
+// Rows of different lengths are stored without padding when padding them
+// to the longest row would take at least twice as much memory. Ragged
+// tables pay with a binary search for the position of a cell, which is
+// only needed when a copied formula is evaluated and on the error paths,
+// and they are not vectorized.
+bool table_should_be_ragged(size_t rows, size_t cols, size_t cells)
+{
+    size_t dense = rows * cols * sizeof(Cell);
+    size_t ragged = (cells + 1) * sizeof(Cell) + (rows + 1) * sizeof(size_t);
+    return dense >= 2 * ragged;
+}
+
+// Text pool (--text-pool)
+//
+// The text cells point into the input, so all of the input stays in
+// memory until the output even when almost all the cells are numbers.
+// The pool copies the texts out of the input, which can then be released
+// right after parsing. Every distinct text is stored once and all the
+// cells with that text share it, which takes the repeated labels of a
+// column down to a single copy each.
+
+#define TEXT_POOL_BLOCK_SIZE (64 * 1024)
+
+typedef struct Text_Block Text_Block;
+
+struct Text_Block {
+    Text_Block *next;
+    size_t count;
+    size_t capacity;
+    char data[];
+};
+
+typedef struct {
+    // Open addressing hash table of the stored texts, a slot with
+    // data == NULL is free
+    String_View *slots;
+    size_t count;
+    size_t capacity;
+    Text_Block *blocks;
+    size_t bytes;
+} Text_Pool;
+
+String_View *text_pool_find(Text_Pool *pool, String_View text)
+{
+    assert(pool->capacity > 0 && (pool->capacity & (pool->capacity - 1)) == 0);
+    size_t mask = pool->capacity - 1;
+    size_t i = (size_t) intern_hash(text) & mask;
+    while (pool->slots[i].data != NULL && !sv_eq(pool->slots[i], text)) {
+        i = (i + 1) & mask;
+    }
+    return &pool->slots[i];
+}
+
+void text_pool_grow(Text_Pool *pool)
+{
+    Text_Pool grown = *pool;
+    grown.capacity = pool->capacity == 0 ? 256 : pool->capacity * 2;
+    grown.slots = calloc(grown.capacity, sizeof(*grown.slots));
+    assert(grown.slots != NULL && "Buy more RAM lol");
+
+    for (size_t i = 0; i < pool->capacity; ++i) {
+        if (pool->slots[i].data != NULL) {
+            *text_pool_find(&grown, pool->slots[i]) = pool->slots[i];
+        }
+    }
+
+    free(pool->slots);
+    *pool = grown;
+}
+
+char *text_pool_alloc(Text_Pool *pool, size_t size)
+{
+    Text_Block *block = pool->blocks;
+    if (block == NULL || block->capacity - block->count < size) {
+        // The long texts get blocks of their own behind the current one,
+        // so they do not waste the rest of it
+        size_t capacity = size > TEXT_POOL_BLOCK_SIZE / 4 ? size : TEXT_POOL_BLOCK_SIZE;
+        block = malloc(sizeof(*block) + capacity);
+        assert(block != NULL && "Buy more RAM lol");
+        block->count = 0;
+        block->capacity = capacity;
+        if (capacity == size && pool->blocks != NULL) {
+            block->next = pool->blocks->next;
+            pool->blocks->next = block;
+        } else {
+            block->next = pool->blocks;
+            pool->blocks = block;
+        }
+        pool->bytes += sizeof(*block) + capacity;
+    }
+
+    char *data = block->data + block->count;
+    block->count += size;
+    return data;
+}
+
+String_View text_pool_add(Text_Pool *pool, String_View text)
+{
+    if (pool->count * 4 >= pool->capacity * 3) {
+        text_pool_grow(pool);
+    }
+
+    String_View *slot = text_pool_find(pool, text);
+    if (slot->data == NULL) {
+        char *data = text_pool_alloc(pool, text.count);
+        memcpy(data, text.data, text.count);
+        *slot = (String_View) {
+            .count = text.count,
+            .data = data,
+        };
+        pool->count += 1;
+    }
+    return *slot;
+}
+
+// Moves the texts of all the `count` cells into the pool. The hash table
+// is only needed while the texts are added.
+void text_pool_cells(Text_Pool *pool, Cell *cells, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        paged_tick(sizeof(Cell));
+        Cell *cell = &cells[i];
+        if (cell->kind == CELL_KIND_TEXT && cell->text != NULL) {
+            stats.pooled_texts += 1;
+            cell_set_text(cell, text_pool_add(pool, cell_text(cell)));
+        }
+    }
+
+    stats.distinct_texts = pool->count;
+    stats.text_pool_bytes = pool->bytes;
+    free(pool->slots);
+    pool->slots = NULL;
+    pool->capacity = 0;
+}
+
+void text_pool_free(Text_Pool *pool)
+{
+    free(pool->slots);
+    while (pool->blocks != NULL) {
+        Text_Block *next = pool->blocks->next;
+        free(pool->blocks);
+        pool->blocks = next;
+    }
+    memset(pool, 0, sizeof(*pool));
+}
+
+// Per-formula profiling (--profile)
+//
+// Every evaluated formula gets the ticks spent and the Expr nodes visited
+// while evaluating it, both including the formulas it pulled in
+// (inclusive) and without them (exclusive). Ticks are TSC cycles on x86
+// and nanoseconds elsewhere.
+
+typedef struct {
+    uint64_t inclusive_ticks;
+    uint64_t exclusive_ticks;
+    size_t inclusive_nodes;
+    size_t exclusive_nodes;
+    size_t fan_in;
+    size_t fan_out;
+} Profile;
+
+// One entry per cell of the table, NULL when profiling is disabled
+Profile *profile = NULL;
+size_t profile_nodes = 0;
+uint64_t profile_child_ticks = 0;
+size_t profile_child_nodes = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+#    define PROFILE_TICKS_UNIT "cycles"
+uint64_t profile_ticks(void)
+{
+    return __rdtsc();
+}
+#else
+#    define PROFILE_TICKS_UNIT "ns"
+uint64_t profile_ticks(void)
+{
+    return clock_ns();
+}
+#endif
+
+// Copying expressions from the neighbor cells
+//
+// A cell `:<`, `:>`, `:^` or `:v` copies the cell to the left, to the
+// right, above or below. Copies of a formula move its references along,
+// so the formula is turned into a tree of references relative to its
+// cell once and every copy shares that tree. Copies are resolved lazily
+// when the cell is evaluated, since the neighbor may not be parsed yet at
+// the time the copy is.
+
+// Returns the same expression with all the cell references relative to
+// (row, col). Subtrees without absolute references are shared.
+Expr_Index expr_relativize(Table *table, Expr_Buffer *eb, Expr_Index expr_index, size_t row, size_t col)
+{
+    Expr expr = *expr_buffer_at(eb, expr_index);
+
+    switch (expr.kind) {
+    case EXPR_KIND_NUMBER:
+    case EXPR_KIND_REL_CELL:
+        return expr_index;
+
+    case EXPR_KIND_CELL:
+    case EXPR_KIND_CELL_INDEX: {
+        // The references are usually linked after the copies are resolved,
+        // but watch mode resolves the new copies of a linked formula
+        size_t ref_row, ref_col;
+        if (expr.kind == EXPR_KIND_CELL) {
+            ref_row = expr.as.cell.row;
+            ref_col = expr.as.cell.col;
+        } else {
+            table_cell_position(table, expr.as.cell_index, &ref_row, &ref_col);
+        }
+
+        Expr_Index result = expr_buffer_alloc(eb);
+        Expr *rel = expr_buffer_at(eb, result);
+        memset(rel, 0, sizeof(*rel));
+        rel->kind = EXPR_KIND_REL_CELL;
+        rel->as.rel_cell.drow = (ptrdiff_t) ref_row - (ptrdiff_t) row;
+        rel->as.rel_cell.dcol = (ptrdiff_t) ref_col - (ptrdiff_t) col;
+        return result;
+    }
+
+    case EXPR_KIND_PLUS: {
+        Expr_Index lhs = expr_relativize(table, eb, expr.as.plus.lhs, row, col);
+        Expr_Index rhs = expr_relativize(table, eb, expr.as.plus.rhs, row, col);
+        if (lhs == expr.as.plus.lhs && rhs == expr.as.plus.rhs) {
+            return expr_index;
+        }
+
+        Expr_Index result = expr_buffer_alloc(eb);
+        Expr *plus = expr_buffer_at(eb, result);
+        memset(plus, 0, sizeof(*plus));
+        plus->kind = EXPR_KIND_PLUS;
+        plus->as.plus.lhs = lhs;
+        plus->as.plus.rhs = rhs;
+        return result;
+    }
+    }
+
+    return expr_index;
+}
+
+// Position of the neighbor in the direction `dir`, false when it is
+// outside of the table
+bool table_neighbor(Table *table, size_t row, size_t col, Dir dir, size_t *out_row, size_t *out_col)
+{
+    switch (dir) {
+    case DIR_LEFT:
+        if (col == 0) return false;
+        col -= 1;
+        break;
+    case DIR_RIGHT:
+        if (col + 1 >= table->cols) return false;
+        col += 1;
+        break;
+    case DIR_UP:
+        if (row == 0) return false;
+        row -= 1;
+        break;
+    case DIR_DOWN:
+        if (row + 1 >= table->rows) return false;
+        row += 1;
+        break;
+    }
+
+    *out_row = row;
+    *out_col = col;
+    return true;
+}
+
+void table_parse_lazy_cell(Expr_Buffer *eb, Cell *cell)
+{
+    assert(cell->kind == CELL_KIND_EXPR && cell->status == UNPARSED);
+
+    // The index of the expression takes the place of the source
+    String_View source = cell_source(cell);
+    Tmp_Cstr tc = {0};
+    cell->index = parse_expr(&source, &tc, eb);
+    cell->value = 0;
+    cell->status = UNEVALUATED;
+    free(tc.cstr);
+}
+
+void table_load_raw_cell(Expr_Buffer *eb, Cell *cell)
+{
+    assert(cell->kind == CELL_KIND_RAW);
+
+    String_View text = cell_text(cell);
+    Tmp_Cstr tc = {0};
+    memset(cell, 0, sizeof(*cell));
+    parse_cell(cell, eb, &tc, text);
+    free(tc.cstr);
+}
+
+void table_resolve_clone(Table *table, Expr_Buffer *eb, size_t row, size_t col)
+{
+    // Follow the chain of copies to the cell that is actually copied.
+    // This is a loop rather than recursion since a copy is usually
+    // repeated along the whole column.
+    size_t src_row = row;
+    size_t src_col = col;
+    Cell *src = table_cell_at(table, src_row, src_col);
+    while (src->kind == CELL_KIND_CLONE) {
+        if (src->resolving) {
+            fprintf(stderr, "ERROR: circular copy is detected!\n");
+            input_error();
+        }
+        src->resolving = true;
+
+        if (!table_neighbor(table, src_row, src_col, src->dir, &src_row, &src_col)) {
+            fprintf(stderr, "ERROR: cannot copy a cell from outside of the table\n");
+            input_error();
+        }
+        src = table_cell_at(table, src_row, src_col);
+        if (src->kind == CELL_KIND_RAW) {
+            table_load_raw_cell(eb, src);
+        }
+    }
+
+    if (src->kind == CELL_KIND_EXPR && src->status == UNPARSED) {
+        table_parse_lazy_cell(eb, src);
+    }
+
+    if (src->kind == CELL_KIND_EXPR && !src->relative) {
+        src->index = expr_relativize(table, eb, src->index, src_row, src_col);
+        src->relative = true;
+    }
+
+    Cell copy = *src;
+    if (copy.kind == CELL_KIND_EXPR) {
+        copy.status = UNEVALUATED;
+        copy.value = 0;
+    }
+
+    size_t r = row;
+    size_t c = col;
+    while (r != src_row || c != src_col) {
+        Cell *cell = table_cell_at(table, r, c);
+        Dir dir = cell->dir;
+        *cell = copy;
+        table_neighbor(table, r, c, dir, &r, &c);
+    }
+}
+
+// Position of the cell that the reference points to when the expression
+// is hosted by the cell at (row, col)
+void expr_cell_position(Table *table, Expr *expr, size_t row, size_t col, size_t *out_row, size_t *out_col)
+{
+    if (expr->kind == EXPR_KIND_CELL) {
+        *out_row = expr->as.cell.row;
+        *out_col = expr->as.cell.col;
+        return;
+    }
+
+    if (expr->kind == EXPR_KIND_CELL_INDEX) {
+        table_cell_position(table, expr->as.cell_index, out_row, out_col);
+        return;
+    }
+
+    assert(expr->kind == EXPR_KIND_REL_CELL);
+    ptrdiff_t r = (ptrdiff_t) row + expr->as.rel_cell.drow;
+    ptrdiff_t c = (ptrdiff_t) col + expr->as.rel_cell.dcol;
+    // Tables built row by row (see --pipeline) grow down while being evaluated
+    bool below = table->row_items == NULL && r >= 0 && (size_t) r >= table->rows;
+    if (r < 0 || c < 0 || (size_t) c >= table->cols || below) {
+        fprintf(stderr, "ERROR: copied expression refers to a cell outside of the table\n");
+        input_error();
+    }
+    *out_row = (size_t) r;
+    *out_col = (size_t) c;
+}
+
+void table_eval_cell(Table *table, Expr_Buffer *eb, size_t row, size_t col);
+
+double table_eval_expr(Table *table, Expr_Buffer *eb, Expr_Index expr_index, size_t row, size_t col)
+{
+    Expr *expr = expr_buffer_at(eb, expr_index);
+
+    if (profile) {
+        profile_nodes += 1;
+    }
+
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+        return expr->as.number;
+
+    case EXPR_KIND_CELL_INDEX: {
+        Cell *cell = &table->cells[expr->as.cell_index];
+        if (cell->kind == CELL_KIND_NUMBER) {
+            return cell->number;
+        }
+
+        if (cell->kind == CELL_KIND_EXPR) {
+            if (cell->status != EVALUATED) {
+                size_t ref_row, ref_col;
+                table_cell_position(table, expr->as.cell_index, &ref_row, &ref_col);
+                table_eval_cell(table, eb, ref_row, ref_col);
+            }
+            return cell->value;
+        }
+
+        fprintf(stderr, "ERROR: text cells may not participate in math expressions\n");
+        input_error();
+    }
+    break;
+
+    case EXPR_KIND_CELL:
+    case EXPR_KIND_REL_CELL: {
+        size_t ref_row, ref_col;
+        expr_cell_position(table, expr, row, col, &ref_row, &ref_col);
+        if (ref_row >= table->rows || (table->row_items == NULL && ref_col >= table->cols)) {
+            fprintf(stderr, "ERROR: cell reference is outside of the table\n");
+            input_error();
+        }
+
+        Cell *cell = table_cell_at(table, ref_row, ref_col);
+        if (cell->kind == CELL_KIND_RAW) {
+            table_load_raw_cell(eb, cell);
+        }
+
+        if (cell->kind == CELL_KIND_CLONE) {
+            table_resolve_clone(table, eb, ref_row, ref_col);
+        }
+
+        switch (cell->kind) {
+        case CELL_KIND_NUMBER:
+            return cell->number;
+        case CELL_KIND_TEXT: {
+            fprintf(stderr, "ERROR: text cells may not participate in math expressions\n");
+            input_error();
+        }
+        break;
+
+        case CELL_KIND_EXPR: {
+            table_eval_cell(table, eb, ref_row, ref_col);
+            return cell->value;
+        }
+        break;
+
+        case CELL_KIND_CLONE:
+        case CELL_KIND_RAW:
+            assert(0 && "unreachable");
+            exit(1);
+        }
+    }
+    break;
+
+    case EXPR_KIND_PLUS: {
+        // Evaluating the left side may parse formulas (see UNPARSED) and
+        // move the Expr_Buffer, so expr is not valid after it
+        Expr_Index rhs_index = expr->as.plus.rhs;
+        double lhs = table_eval_expr(table, eb, expr->as.plus.lhs, row, col);
+        double rhs = table_eval_expr(table, eb, rhs_index, row, col);
+        return lhs + rhs;
+    }
+    break;
+    }
+    return 0;
+}
+
+void table_eval_cell(Table *table, Expr_Buffer *eb, size_t row, size_t col)
+{
+    Cell *cell = table_cell_at(table, row, col);
+    if (cell->kind == CELL_KIND_RAW) {
+        table_load_raw_cell(eb, cell);
+    }
+
+    if (cell->kind == CELL_KIND_CLONE) {
+        table_resolve_clone(table, eb, row, col);
+    }
+
+    if (cell->kind == CELL_KIND_EXPR) {
+        if (cell->status == UNPARSED) {
+            table_parse_lazy_cell(eb, cell);
+        }
+
+        if (cell->status == INPROGRESS) {
+            fprintf(stderr, "ERROR: circular dependency is detected!\n");
+            input_error();
+        }
+
+        if (cell->status == UNEVALUATED) {
+            cell->status = INPROGRESS;
+            stats.eval_depth += 1;
+            if (stats.eval_depth > stats.max_eval_depth) {
+                stats.max_eval_depth = stats.eval_depth;
+            }
+
+            if (profile) {
+                uint64_t saved_child_ticks = profile_child_ticks;
+                size_t saved_child_nodes = profile_child_nodes;
+                profile_child_ticks = 0;
+                profile_child_nodes = 0;
+                size_t start_nodes = profile_nodes;
+                uint64_t start = profile_ticks();
+
+                cell->value = table_eval_expr(table, eb, cell->index, row, col);
+
+                uint64_t ticks = profile_ticks() - start;
+                size_t nodes = profile_nodes - start_nodes;
+                Profile *entry = &profile[table_cell_index(table, row, col)];
+                entry->inclusive_ticks += ticks;
+                entry->exclusive_ticks += ticks - profile_child_ticks;
+                entry->inclusive_nodes += nodes;
+                entry->exclusive_nodes += nodes - profile_child_nodes;
+                profile_child_ticks = saved_child_ticks + ticks;
+                profile_child_nodes = saved_child_nodes + nodes;
+            } else {
+                cell->value = table_eval_expr(table, eb, cell->index, row, col);
+            }
+
+            stats.eval_depth -= 1;
+            cell->status = EVALUATED;
+        }
+    }
+}
+
+// Vectorized evaluation of repeated formulas
+//
+// A formula copied down a column with `:^` or `:v` is shared by all its
+// copies as a single tree of relative references (see CELL_KIND_CLONE).
+// Such runs of cells are evaluated up to VECTOR_WIDTH rows at a time: the
+// shared tree is compiled into a short postfix program, the values of
+// every reference are gathered into a contiguous array and the additions
+// are done on whole arrays. The rows whose inputs are not evaluated yet
+// fall back to table_eval_cell(), which also reports all the errors.
+
+#define VECTOR_WIDTH 64
+#define VECTOR_MAX_OPS 32
+
+bool vectorize = true;
+
+typedef struct {
+    // EXPR_KIND_NUMBER, EXPR_KIND_REL_CELL or EXPR_KIND_PLUS
+    Expr_Kind kind;
+    double number;
+    ptrdiff_t drow;
+    ptrdiff_t dcol;
+    // Distance from the hosting cell in Table.cells
+    ptrdiff_t offset;
+} Vector_Op;
+
+typedef struct {
+    Vector_Op ops[VECTOR_MAX_OPS];
+    size_t count;
+    // The rows and columns the references reach relative to the hosting cell
+    ptrdiff_t min_drow, max_drow;
+    ptrdiff_t min_dcol, max_dcol;
+} Vector_Program;
+
+bool vector_compile(Table *table, Expr_Buffer *eb, Expr_Index expr_index, Vector_Program *program)
+{
+    Expr *expr = expr_buffer_at(eb, expr_index);
+
+    if (expr->kind == EXPR_KIND_PLUS) {
+        if (!vector_compile(table, eb, expr->as.plus.lhs, program) ||
+            !vector_compile(table, eb, expr->as.plus.rhs, program)) {
+            return false;
+        }
+    }
+
+    if (program->count >= VECTOR_MAX_OPS) {
+        return false;
+    }
+
+    Vector_Op *op = &program->ops[program->count++];
+    memset(op, 0, sizeof(*op));
+    op->kind = expr->kind;
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+        op->number = expr->as.number;
+        break;
+
+    case EXPR_KIND_REL_CELL:
+        op->drow = expr->as.rel_cell.drow;
+        op->dcol = expr->as.rel_cell.dcol;
+        op->offset = op->drow * (ptrdiff_t) table->cols + op->dcol;
+        if (op->drow < program->min_drow) program->min_drow = op->drow;
+        if (op->drow > program->max_drow) program->max_drow = op->drow;
+        if (op->dcol < program->min_dcol) program->min_dcol = op->dcol;
+        if (op->dcol > program->max_dcol) program->max_dcol = op->dcol;
+        break;
+
+    case EXPR_KIND_PLUS:
+        break;
+
+    case EXPR_KIND_CELL:
+    case EXPR_KIND_CELL_INDEX:
+        assert(0 && "shared expressions have only relative references");
+        exit(1);
+    }
+
+    return true;
+}
+
+void vector_add(double *out, const double *lhs, const double *rhs, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(lhs + i), _mm256_loadu_pd(rhs + i)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(lhs + i), _mm_loadu_pd(rhs + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        out[i] = lhs[i] + rhs[i];
+    }
+}
+
+// Runs the program over `n` rows whose referenced values are gathered in
+// `inputs` and returns the array with the results
+double *vector_run(const Vector_Program *program, double inputs[][VECTOR_WIDTH],
+                   double scratch[][VECTOR_WIDTH], size_t n)
+{
+    double *stack[VECTOR_MAX_OPS];
+    size_t sp = 0;
+    size_t ref = 0;
+
+    for (size_t i = 0; i < program->count; ++i) {
+        const Vector_Op *op = &program->ops[i];
+        switch (op->kind) {
+        case EXPR_KIND_NUMBER:
+            for (size_t lane = 0; lane < n; ++lane) {
+                scratch[sp][lane] = op->number;
+            }
+            stack[sp] = scratch[sp];
+            sp += 1;
+            break;
+
+        case EXPR_KIND_REL_CELL:
+            stack[sp++] = inputs[ref++];
+            break;
+
+        case EXPR_KIND_PLUS:
+            assert(sp >= 2);
+            vector_add(scratch[sp - 2], stack[sp - 2], stack[sp - 1], n);
+            stack[sp - 2] = scratch[sp - 2];
+            sp -= 1;
+            break;
+
+        case EXPR_KIND_CELL:
+        case EXPR_KIND_CELL_INDEX:
+            assert(0 && "unreachable");
+            exit(1);
+        }
+    }
+
+    assert(sp == 1);
+    return stack[0];
+}
+
+// Gathers the values the program refers to from the cell `host` into the
+// lane `lane` of `inputs`. Fails if any of them is not a number or an
+// evaluated formula. All the references must be inside of the table.
+bool vector_gather(const Vector_Program *program, Cell *host, double inputs[][VECTOR_WIDTH], size_t lane)
+{
+    size_t ref = 0;
+    for (size_t i = 0; i < program->count; ++i) {
+        const Vector_Op *op = &program->ops[i];
+        if (op->kind != EXPR_KIND_REL_CELL) {
+            continue;
+        }
+
+        Cell *cell = host + op->offset;
+        if (cell->kind == CELL_KIND_NUMBER) {
+            inputs[ref++][lane] = cell->number;
+        } else if (cell->kind == CELL_KIND_EXPR && cell->status == EVALUATED) {
+            inputs[ref++][lane] = cell->value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Evaluates the cells of the rows [begin, end) of the column that share
+// the expression `expr_index` compiled into `program` and returns the row
+// where the run ends
+size_t table_eval_run(Table *table, Expr_Buffer *eb, const Vector_Program *program,
+                      Expr_Index expr_index, size_t begin, size_t end, size_t col)
+{
+    double inputs[VECTOR_MAX_OPS][VECTOR_WIDTH];
+    double scratch[VECTOR_MAX_OPS][VECTOR_WIDTH];
+    Cell *cells[VECTOR_WIDTH];
+    size_t n = 0;
+
+    // The rows of the run where all the references are inside of the table
+    bool cols_inside = (ptrdiff_t) col + program->min_dcol >= 0 &&
+                       (ptrdiff_t) col + program->max_dcol < (ptrdiff_t) table->cols;
+    ptrdiff_t rows_begin = -program->min_drow;
+    ptrdiff_t rows_end = (ptrdiff_t) table->rows - program->max_drow;
+
+    assert(end - begin <= VECTOR_WIDTH);
+    size_t row = begin;
+    for (; row < end; ++row) {
+        Cell *cell = &table->cells[row * table->cols + col];
+        if (cell->kind == CELL_KIND_CLONE) {
+            table_resolve_clone(table, eb, row, col);
+        }
+
+        if (cell->kind != CELL_KIND_EXPR || cell->index != expr_index) {
+            break;
+        }
+
+        if (cell->status == UNEVALUATED) {
+            if (cols_inside && (ptrdiff_t) row >= rows_begin && (ptrdiff_t) row < rows_end &&
+                vector_gather(program, cell, inputs, n)) {
+                cells[n++] = cell;
+            } else {
+                table_eval_cell(table, eb, row, col);
+            }
+        }
+    }
+
+    if (n > 0) {
+        double *values = vector_run(program, inputs, scratch, n);
+        for (size_t i = 0; i < n; ++i) {
+            cells[i]->value = values[i];
+            cells[i]->status = EVALUATED;
+        }
+        stats.vectorized_cells += n;
+        if (stats.max_eval_depth < 1) {
+            stats.max_eval_depth = 1;
+        }
+    }
+
+    return row;
+}
+
+// Evaluates the whole table VECTOR_WIDTH rows at a time, so the rows stay
+// in the cache while every column is evaluated
+void table_eval_vectorized(Table *table, Expr_Buffer *eb)
+{
+    // The programs address the cells by their distance in Table.cells
+    assert(table->row_items == NULL && table->row_offsets == NULL && table->layout == LAYOUT_ROWS);
+
+    for (size_t begin = 0; begin < table->rows; begin += VECTOR_WIDTH) {
+        paged_tick(VECTOR_WIDTH * table->cols * sizeof(Cell));
+        size_t end = begin + VECTOR_WIDTH < table->rows ? begin + VECTOR_WIDTH : table->rows;
+
+        for (size_t col = 0; col < table->cols; ++col) {
+            size_t row = begin;
+            while (row + 1 < end) {
+                // A run starts where the cell below shares the expression
+                Cell *cell = &table->cells[row * table->cols + col];
+                Cell *next = cell + table->cols;
+                if (next->kind != CELL_KIND_CLONE && !(next->kind == CELL_KIND_EXPR && next->relative)) {
+                    row += 1;
+                    continue;
+                }
+
+                // Copying the cell below may replace the expression of this
+                // one with the shared one, so it goes first
+                if (next->kind == CELL_KIND_CLONE) {
+                    table_resolve_clone(table, eb, row + 1, col);
+                }
+
+                if (cell->kind == CELL_KIND_CLONE) {
+                    table_resolve_clone(table, eb, row, col);
+                }
+
+                // A formula that is not shared is left to table_eval_cell()
+                if (cell->kind != CELL_KIND_EXPR || !cell->relative ||
+                    cell->status != UNEVALUATED ||
+                    next->kind != CELL_KIND_EXPR || next->index != cell->index) {
+                    row += 1;
+                    continue;
+                }
+
+                Vector_Program program = {0};
+                if (!vector_compile(table, eb, cell->index, &program)) {
+                    row += 1;
+                    continue;
+                }
+
+                row = table_eval_run(table, eb, &program, cell->index, row, end, col);
+            }
+        }
+
+        for (size_t row = begin; row < end; ++row) {
+            for (size_t col = 0; col < table->cols; ++col) {
+                table_eval_cell(table, eb, row, col);
+            }
+        }
+    }
+}
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    char *items;
+} String_Builder;
+
+void sb_append(String_Builder *sb, const void *data, size_t size)
+{
+    if (sb->count + size > sb->capacity) {
+        if (sb->capacity == 0) {
+            sb->capacity = 1024;
+        }
+
+        while (sb->count + size > sb->capacity) {
+            sb->capacity *= 2;
+        }
+
+        sb->items = realloc(sb->items, sb->capacity);
+        assert(sb->items != NULL && "Buy more RAM lol");
+    }
+
+    memcpy(sb->items + sb->count, data, size);
+    sb->count += size;
+}
+
+void sb_pad(String_Builder *sb, size_t alignment)
+{
+    static const char zeros[64] = {0};
+    assert(alignment <= sizeof(zeros));
+    size_t rem = sb->count % alignment;
+    if (rem > 0) {
+        sb_append(sb, zeros, alignment - rem);
+    }
+}
+
+void sb_append_double(String_Builder *sb, double x)
+{
+    // "%lf" of DBL_MAX is a bit over 300 characters
+    char buffer[512];
+    int n = snprintf(buffer, sizeof(buffer), "%lf", x);
+    assert(n >= 0 && (size_t) n < sizeof(buffer));
+    sb_append(sb, buffer, (size_t) n);
+}
+
+// Appends the text of a field without its quotes (see csv_index_of()).
+// The text output keeps the quotes, so it can be read back.
+void sb_append_unquoted(String_Builder *sb, String_View text)
+{
+    if (memchr(text.data, '"', text.count) == NULL) {
+        sb_append(sb, text.data, text.count);
+        return;
+    }
+
+    bool inside = false;
+    for (size_t i = 0; i < text.count; ++i) {
+        if (text.data[i] != '"') {
+            sb_append(sb, &text.data[i], 1);
+        } else if (inside && i + 1 < text.count && text.data[i + 1] == '"') {
+            sb_append(sb, "\"", 1);
+            i += 1;
+        } else {
+            inside = !inside;
+        }
+    }
+}
+
+void sb_append_cell(String_Builder *sb, Cell *cell)
+{
+    switch (cell->kind) {
+    case CELL_KIND_TEXT:
+        sb_append(sb, cell->text, cell->text_count);
+        break;
+
+    case CELL_KIND_NUMBER:
+        sb_append_double(sb, cell->number);
+        break;
+
+    case CELL_KIND_EXPR:
+        sb_append_double(sb, cell->value);
+        break;
+
+    case CELL_KIND_CLONE:
+    case CELL_KIND_RAW:
+        assert(0 && "unreachable");
+        exit(1);
+    }
+}
+
+void table_format_rows(Table *table, size_t begin, size_t end, String_Builder *sb)
+{
+    for (size_t row = begin; row < end; ++row) {
+        paged_tick(table->cols * sizeof(Cell));
+        for (size_t col = 0; col < table->cols; ++col) {
+            sb_append_cell(sb, table_cell_at(table, row, col));
+
+            if (col < table->cols - 1) {
+                sb_append(sb, "|", 1);
+            }
+        }
+        sb_append(sb, "\n", 1);
+    }
+}
+
+#define TEXT_FLUSH_SIZE (64 * 1024)
+
+void table_dump_text(FILE *stream, Table *table)
+{
+    String_Builder sb = {0};
+    for (size_t row = 0; row < table->rows; ++row) {
+        table_format_rows(table, row, row + 1, &sb);
+        if (sb.count >= TEXT_FLUSH_SIZE) {
+            TRACE_BEGIN("flush");
+            fwrite(sb.items, 1, sb.count, stream);
+            TRACE_END("flush");
+            sb.count = 0;
+        }
+    }
+    TRACE_BEGIN("flush");
+    fwrite(sb.items, 1, sb.count, stream);
+    TRACE_END("flush");
+    free(sb.items);
+}
+
+// Evaluates and writes the table row by row, so the first rows are out
+// before the formulas further down are even parsed (--lazy)
+void table_eval_dump_text(FILE *stream, Table *table, Expr_Buffer *eb)
+{
+    String_Builder sb = {0};
+    for (size_t row = 0; row < table->rows; ++row) {
+        for (size_t col = 0; col < table->cols; ++col) {
+            table_eval_cell(table, eb, row, col);
+        }
+
+        table_format_rows(table, row, row + 1, &sb);
+        if (sb.count >= TEXT_FLUSH_SIZE) {
+            TRACE_BEGIN("flush");
+            fwrite(sb.items, 1, sb.count, stream);
+            fflush(stream);
+            TRACE_END("flush");
+            sb.count = 0;
+        }
+    }
+    TRACE_BEGIN("flush");
+    fwrite(sb.items, 1, sb.count, stream);
+    TRACE_END("flush");
+    free(sb.items);
+}
+
+// Parallel text output
+//
+// The rows are split into one contiguous range per job and every job
+// formats its range into a private buffer. Once all the buffers are ready
+// their offsets in the output are known, so for regular files the jobs
+// pwrite() them concurrently. Everything else (pipes, terminals, files
+// opened with O_APPEND) gets the buffers with writev() in order.
+
+typedef struct {
+    Table *table;
+    size_t begin;
+    size_t end;
+    String_Builder sb;
+    int fd;
+    off_t offset;
+} Format_Job;
+
+void *format_job_run(void *arg)
+{
+    Format_Job *job = arg;
+    TRACE_THREAD_NAME("format job");
+    TRACE_BEGIN("format rows");
+    table_format_rows(job->table, job->begin, job->end, &job->sb);
+    TRACE_END("format rows");
+    return NULL;
+}
+
+void *pwrite_job_run(void *arg)
+{
+    Format_Job *job = arg;
+    TRACE_THREAD_NAME("format job");
+    TRACE_BEGIN("pwrite");
+    size_t written = 0;
+    while (written < job->sb.count) {
+        ssize_t n = pwrite(job->fd, job->sb.items + written, job->sb.count - written,
+                           job->offset + (off_t) written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ERROR: could not write the output: %s\n", strerror(errno));
+            exit(1);
+        }
+        written += (size_t) n;
+    }
+    TRACE_END("pwrite");
+    return NULL;
+}
+
+void run_jobs(void *(*run)(void *), void *jobs, size_t job_size, size_t jobs_count)
+{
+    pthread_t *threads = malloc(sizeof(*threads) * jobs_count);
+    for (size_t i = 0; i < jobs_count; ++i) {
+        int err = pthread_create(&threads[i], NULL, run, (char *) jobs + i * job_size);
+        if (err != 0) {
+            fprintf(stderr, "ERROR: could not create a thread: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    for (size_t i = 0; i < jobs_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+void writev_all(int fd, struct iovec *iov, size_t iov_count)
+{
+    while (iov_count > 0) {
+        int batch = iov_count > IOV_MAX ? IOV_MAX : (int) iov_count;
+        ssize_t n = writev(fd, iov, batch);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ERROR: could not write the output: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        size_t written = (size_t) n;
+        while (iov_count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov += 1;
+            iov_count -= 1;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+void table_dump_text_parallel(FILE *stream, Table *table, size_t jobs_count)
+{
+    if (jobs_count > table->rows) {
+        jobs_count = table->rows;
+    }
+    if (jobs_count <= 1) {
+        table_dump_text(stream, table);
+        return;
+    }
+
+    Format_Job *jobs = malloc(sizeof(*jobs) * jobs_count);
+    memset(jobs, 0, sizeof(*jobs) * jobs_count);
+    for (size_t i = 0; i < jobs_count; ++i) {
+        jobs[i].table = table;
+        jobs[i].begin = table->rows * i / jobs_count;
+        jobs[i].end = table->rows * (i + 1) / jobs_count;
+    }
+    run_jobs(format_job_run, jobs, sizeof(*jobs), jobs_count);
+
+    fflush(stream);
+    int fd = fileno(stream);
+    struct stat st;
+    off_t base = lseek(fd, 0, SEEK_CUR);
+    bool positional = base >= 0 &&
+                      fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                      !(fcntl(fd, F_GETFL) & O_APPEND);
+
+    if (positional) {
+        off_t offset = base;
+        for (size_t i = 0; i < jobs_count; ++i) {
+            jobs[i].fd = fd;
+            jobs[i].offset = offset;
+            offset += (off_t) jobs[i].sb.count;
+        }
+        run_jobs(pwrite_job_run, jobs, sizeof(*jobs), jobs_count);
+        lseek(fd, offset, SEEK_SET);
+    } else {
+        struct iovec *iov = malloc(sizeof(*iov) * jobs_count);
+        for (size_t i = 0; i < jobs_count; ++i) {
+            iov[i].iov_base = jobs[i].sb.items;
+            iov[i].iov_len = jobs[i].sb.count;
+        }
+        TRACE_BEGIN("writev");
+        writev_all(fd, iov, jobs_count);
+        TRACE_END("writev");
+        free(iov);
+    }
+
+    for (size_t i = 0; i < jobs_count; ++i) {
+        free(jobs[i].sb.items);
+    }
+    free(jobs);
+}
+
+// Arrow IPC streaming format
+// https://arrow.apache.org/docs/format/Columnar.html#ipc-streaming-format
+//
+// The stream is a Schema message followed by RecordBatch messages and
+// the end-of-stream marker. Every message is framed as
+//
+//   <0xFFFFFFFF> <int32 metadata size> <flatbuffer Message> <body>
+//
+// The flatbuffers are built front to back: vtables are written right
+// before their tables and child offsets are patched in once the child is
+// emitted. Only the little-endian layout is supported.
+
+typedef struct {
+    size_t vtable;
+    size_t table;
+    size_t fields;
+} Fb_Table;
+
+Fb_Table fb_table_begin(String_Builder *sb, size_t fields)
+{
+    Fb_Table t = {0};
+    t.fields = fields;
+
+    sb_pad(sb, 2);
+    t.vtable = sb->count;
+    uint16_t vtable_size = (uint16_t) (2 + fields) * sizeof(uint16_t);
+    sb_append(sb, &vtable_size, sizeof(vtable_size));
+    for (size_t i = 0; i < 1 + fields; ++i) {
+        uint16_t zero = 0;
+        sb_append(sb, &zero, sizeof(zero));
+    }
+
+    sb_pad(sb, 4);
+    t.table = sb->count;
+    int32_t soffset = (int32_t) (t.table - t.vtable);
+    sb_append(sb, &soffset, sizeof(soffset));
+
+    return t;
+}
+
+size_t fb_table_field(String_Builder *sb, Fb_Table *t, size_t id, const void *data, size_t size)
+{
+    assert(id < t->fields);
+    sb_pad(sb, size);
+    size_t at = sb->count;
+    sb_append(sb, data, size);
+
+    uint16_t offset = (uint16_t) (at - t->table);
+    memcpy(sb->items + t->vtable + (2 + id) * sizeof(uint16_t), &offset, sizeof(offset));
+    return at;
+}
+
+// Reserves an offset field that is later patched with fb_patch()
+size_t fb_table_offset_field(String_Builder *sb, Fb_Table *t, size_t id)
+{
+    uint32_t placeholder = 0;
+    return fb_table_field(sb, t, id, &placeholder, sizeof(placeholder));
+}
+
+void fb_table_end(String_Builder *sb, Fb_Table *t)
+{
+    uint16_t table_size = (uint16_t) (sb->count - t->table);
+    memcpy(sb->items + t->vtable + sizeof(uint16_t), &table_size, sizeof(table_size));
+}
+
+void fb_patch(String_Builder *sb, size_t at, size_t target)
+{
+    assert(at < target);
+    uint32_t offset = (uint32_t) (target - at);
+    memcpy(sb->items + at, &offset, sizeof(offset));
+}
+
+size_t fb_string(String_Builder *sb, String_View s)
+{
+    sb_pad(sb, 4);
+    size_t at = sb->count;
+    uint32_t count = (uint32_t) s.count;
+    sb_append(sb, &count, sizeof(count));
+    sb_append(sb, s.data, s.count);
+    sb_append(sb, "", 1);
+    return at;
+}
+
+// Starts a vector so that its elements are aligned to `alignment`
+size_t fb_vector_begin(String_Builder *sb, size_t count, size_t alignment)
+{
+    sb_pad(sb, 4);
+    while ((sb->count + sizeof(uint32_t)) % alignment != 0) {
+        sb_append(sb, "\0\0\0\0", 4);
+    }
+    size_t at = sb->count;
+    uint32_t count32 = (uint32_t) count;
+    sb_append(sb, &count32, sizeof(count32));
+    return at;
+}
+
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_UTF8 5
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_BATCH_ROWS (64 * 1024)
+
+typedef enum {
+    ARROW_COLUMN_FLOAT64 = 0,
+    ARROW_COLUMN_UTF8,
+} Arrow_Column_Type;
+
+typedef struct {
+    int64_t offset;
+    int64_t length;
+} Arrow_Buffer;
+
+typedef struct {
+    int64_t length;
+    int64_t null_count;
+} Arrow_Field_Node;
+
+typedef struct {
+    String_Builder metadata;
+    String_Builder body;
+    String_Builder message;
+    Arrow_Field_Node *nodes;
+    Arrow_Buffer *buffers;
+    size_t buffers_count;
+} Arrow_Writer;
+
+// Writes the Message table and returns the position of its header offset
+size_t arrow_message_begin(String_Builder *sb, uint8_t header_type, int64_t body_length)
+{
+    sb->count = 0;
+    uint32_t root = 0;
+    sb_append(sb, &root, sizeof(root));
+
+    Fb_Table message = fb_table_begin(sb, 4);
+    int16_t version = ARROW_METADATA_V5;
+    fb_table_field(sb, &message, 0, &version, sizeof(version));
+    fb_table_field(sb, &message, 1, &header_type, sizeof(header_type));
+    size_t header = fb_table_offset_field(sb, &message, 2);
+    fb_table_field(sb, &message, 3, &body_length, sizeof(body_length));
+    fb_table_end(sb, &message);
+    fb_patch(sb, 0, message.table);
+
+    return header;
+}
+
+void arrow_write_message(FILE *stream, Arrow_Writer *w)
+{
+    sb_pad(&w->metadata, 8);
+    sb_pad(&w->body, 8);
+
+    w->message.count = 0;
+    uint32_t continuation = 0xFFFFFFFF;
+    int32_t metadata_size = (int32_t) w->metadata.count;
+    sb_append(&w->message, &continuation, sizeof(continuation));
+    sb_append(&w->message, &metadata_size, sizeof(metadata_size));
+    sb_append(&w->message, w->metadata.items, w->metadata.count);
+    sb_append(&w->message, w->body.items, w->body.count);
+
+    TRACE_BEGIN("flush");
+    fwrite(w->message.items, 1, w->message.count, stream);
+    TRACE_END("flush");
+}
+
+void column_name(String_Builder *sb, size_t col)
+{
+    char letters[32];
+    size_t n = 0;
+    for (col += 1; col > 0; col = (col - 1) / 26) {
+        letters[n++] = (char) ('A' + (col - 1) % 26);
+    }
+    while (n > 0) {
+        sb_append(sb, &letters[--n], 1);
+    }
+}
+
+bool cell_is_empty(Cell *cell)
+{
+    return cell->kind == CELL_KIND_TEXT && cell->text_count == 0;
+}
+
+double cell_number(Cell *cell)
+{
+    if (cell->kind == CELL_KIND_EXPR) {
+        return cell->value;
+    }
+    assert(cell->kind == CELL_KIND_NUMBER);
+    return cell->number;
+}
+
+void arrow_write_schema(FILE *stream, Arrow_Writer *w, Table *table,
+                        const Arrow_Column_Type *types, bool header)
+{
+    String_Builder *sb = &w->metadata;
+    size_t schema_header = arrow_message_begin(sb, ARROW_HEADER_SCHEMA, 0);
+
+    Fb_Table schema = fb_table_begin(sb, 2);
+    size_t fields = fb_table_offset_field(sb, &schema, 1);
+    fb_table_end(sb, &schema);
+    fb_patch(sb, schema_header, schema.table);
+
+    size_t vector = fb_vector_begin(sb, table->cols, 4);
+    fb_patch(sb, fields, vector);
+    size_t field_offsets = sb->count;
+    for (size_t col = 0; col < table->cols; ++col) {
+        uint32_t placeholder = 0;
+        sb_append(sb, &placeholder, sizeof(placeholder));
+    }
+
+    String_Builder name = {0};
+    for (size_t col = 0; col < table->cols; ++col) {
+        Fb_Table field = fb_table_begin(sb, 6);
+        size_t name_field = fb_table_offset_field(sb, &field, 0);
+        uint8_t nullable = 1;
+        fb_table_field(sb, &field, 1, &nullable, sizeof(nullable));
+        uint8_t type_type = types[col] == ARROW_COLUMN_FLOAT64 ? ARROW_TYPE_FLOATING_POINT : ARROW_TYPE_UTF8;
+        fb_table_field(sb, &field, 2, &type_type, sizeof(type_type));
+        size_t type_field = fb_table_offset_field(sb, &field, 3);
+        size_t children_field = fb_table_offset_field(sb, &field, 5);
+        fb_table_end(sb, &field);
+        fb_patch(sb, field_offsets + col * sizeof(uint32_t), field.table);
+
+        name.count = 0;
+        if (header && !cell_is_empty(table_cell_at(table, 0, col))) {
+            sb_append_unquoted(&name, cell_text(table_cell_at(table, 0, col)));
+        } else {
+            column_name(&name, col);
+        }
+        fb_patch(sb, name_field, fb_string(sb, (String_View) {
+            .count = name.count,
+            .data = name.items,
+        }));
+
+        if (types[col] == ARROW_COLUMN_FLOAT64) {
+            Fb_Table type = fb_table_begin(sb, 1);
+            int16_t precision = ARROW_PRECISION_DOUBLE;
+            fb_table_field(sb, &type, 0, &precision, sizeof(precision));
+            fb_table_end(sb, &type);
+            fb_patch(sb, type_field, type.table);
+        } else {
+            Fb_Table type = fb_table_begin(sb, 0);
+            fb_table_end(sb, &type);
+            fb_patch(sb, type_field, type.table);
+        }
+
+        fb_patch(sb, children_field, fb_vector_begin(sb, 0, 4));
+    }
+    free(name.items);
+
+    w->body.count = 0;
+    arrow_write_message(stream, w);
+}
+
+void arrow_body_buffer(Arrow_Writer *w, const void *data, size_t size)
+{
+    w->buffers[w->buffers_count].offset = (int64_t) w->body.count;
+    w->buffers[w->buffers_count].length = (int64_t) size;
+    w->buffers_count += 1;
+    if (size > 0) {
+        sb_append(&w->body, data, size);
+    }
+    sb_pad(&w->body, 8);
+}
+
+void arrow_write_record_batch(FILE *stream, Arrow_Writer *w, Table *table,
+                              const Arrow_Column_Type *types, size_t begin, size_t end)
+{
+    size_t length = end - begin;
+    size_t bitmap_size = (length + 7) / 8;
+    uint8_t *bitmap = malloc(bitmap_size);
+    String_Builder values = {0};
+    String_Builder offsets = {0};
+
+    w->body.count = 0;
+    w->buffers_count = 0;
+
+    for (size_t col = 0; col < table->cols; ++col) {
+        memset(bitmap, 0, bitmap_size);
+        values.count = 0;
+        offsets.count = 0;
+        int64_t null_count = 0;
+
+        int32_t offset = 0;
+        sb_append(&offsets, &offset, sizeof(offset));
+
+        for (size_t row = begin; row < end; ++row) {
+            Cell *cell = table_cell_at(table, row, col);
+            bool valid = !cell_is_empty(cell);
+            if (valid) {
+                bitmap[(row - begin) / 8] |= (uint8_t) (1 << ((row - begin) % 8));
+            } else {
+                null_count += 1;
+            }
+
+            if (types[col] == ARROW_COLUMN_FLOAT64) {
+                double x = valid ? cell_number(cell) : 0.0;
+                sb_append(&values, &x, sizeof(x));
+            } else {
+                if (cell->kind == CELL_KIND_TEXT) {
+                    sb_append_unquoted(&values, cell_text(cell));
+                } else {
+                    sb_append_double(&values, cell_number(cell));
+                }
+                offset = (int32_t) values.count;
+                sb_append(&offsets, &offset, sizeof(offset));
+            }
+        }
+
+        w->nodes[col].length = (int64_t) length;
+        w->nodes[col].null_count = null_count;
+        arrow_body_buffer(w, bitmap, null_count > 0 ? bitmap_size : 0);
+        if (types[col] == ARROW_COLUMN_UTF8) {
+            arrow_body_buffer(w, offsets.items, offsets.count);
+        }
+        arrow_body_buffer(w, values.items, values.count);
+    }
+
+    String_Builder *sb = &w->metadata;
+    size_t batch_header = arrow_message_begin(sb, ARROW_HEADER_RECORD_BATCH, (int64_t) w->body.count);
+
+    Fb_Table batch = fb_table_begin(sb, 3);
+    int64_t length64 = (int64_t) length;
+    fb_table_field(sb, &batch, 0, &length64, sizeof(length64));
+    size_t nodes_field = fb_table_offset_field(sb, &batch, 1);
+    size_t buffers_field = fb_table_offset_field(sb, &batch, 2);
+    fb_table_end(sb, &batch);
+    fb_patch(sb, batch_header, batch.table);
+
+    fb_patch(sb, nodes_field, fb_vector_begin(sb, table->cols, 8));
+    sb_append(sb, w->nodes, sizeof(*w->nodes) * table->cols);
+    fb_patch(sb, buffers_field, fb_vector_begin(sb, w->buffers_count, 8));
+    sb_append(sb, w->buffers, sizeof(*w->buffers) * w->buffers_count);
+
+    arrow_write_message(stream, w);
+
+    free(values.items);
+    free(offsets.items);
+    free(bitmap);
+}
+
+// Columns that contain only numbers and expressions become float64,
+// everything else is utf8. Empty cells are nulls. If the first row is
+// all text it is used for the column names.
+void table_dump_arrow(FILE *stream, Table *table)
+{
+    bool header = table->rows > 0 && !cell_is_empty(table_cell_at(table, 0, 0));
+    for (size_t col = 0; col < table->cols && header; ++col) {
+        header = table_cell_at(table, 0, col)->kind == CELL_KIND_TEXT;
+    }
+    size_t first_row = header ? 1 : 0;
+
+    Arrow_Column_Type *types = malloc(sizeof(*types) * table->cols);
+    for (size_t col = 0; col < table->cols; ++col) {
+        types[col] = ARROW_COLUMN_FLOAT64;
+        for (size_t row = first_row; row < table->rows; ++row) {
+            Cell *cell = table_cell_at(table, row, col);
+            if (cell->kind == CELL_KIND_TEXT && !cell_is_empty(cell)) {
+                types[col] = ARROW_COLUMN_UTF8;
+                break;
+            }
+        }
+    }
+
+    Arrow_Writer w = {0};
+    w.nodes = malloc(sizeof(*w.nodes) * table->cols);
+    w.buffers = malloc(sizeof(*w.buffers) * table->cols * 3);
+
+    arrow_write_schema(stream, &w, table, types, header);
+    for (size_t begin = first_row; begin < table->rows; begin += ARROW_BATCH_ROWS) {
+        size_t end = begin + ARROW_BATCH_ROWS;
+        if (end > table->rows) {
+            end = table->rows;
+        }
+        paged_tick((end - begin) * table->cols * sizeof(Cell));
+        arrow_write_record_batch(stream, &w, table, types, begin, end);
+    }
+
+    uint32_t end_of_stream[2] = {0xFFFFFFFF, 0};
+    fwrite(end_of_stream, sizeof(end_of_stream), 1, stream);
+
+    free(w.metadata.items);
+    free(w.body.items);
+    free(w.message.items);
+    free(w.nodes);
+    free(w.buffers);
+    free(types);
+}
+
+void sb_append_cell_name(String_Builder *sb, size_t row, size_t col)
+{
+    char buffer[32];
+    column_name(sb, col);
+    int n = snprintf(buffer, sizeof(buffer), "%zu", row);
+    sb_append(sb, buffer, (size_t) n);
+}
+
+// Linking the references
+//
+// Before the evaluation every reference of the table is checked once and
+// the absolute ones are replaced with the index of the referenced cell in
+// Table.cells, so the evaluator follows them without any bounds checks or
+// multiplications. All the references outside of the table are reported
+// together with the cells they come from.
+
+// Returns the number of bad references in the expression hosted by the
+// cell (row, col)
+size_t table_link_expr(Table *table, Expr_Buffer *eb, Expr_Index expr_index, size_t row, size_t col)
+{
+    Expr *expr = expr_buffer_at(eb, expr_index);
+
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+    case EXPR_KIND_CELL_INDEX:
+        return 0;
+
+    case EXPR_KIND_CELL:
+    case EXPR_KIND_REL_CELL: {
+        ptrdiff_t ref_row, ref_col;
+        if (expr->kind == EXPR_KIND_CELL) {
+            ref_row = (ptrdiff_t) expr->as.cell.row;
+            ref_col = (ptrdiff_t) expr->as.cell.col;
+        } else {
+            ref_row = (ptrdiff_t) row + expr->as.rel_cell.drow;
+            ref_col = (ptrdiff_t) col + expr->as.rel_cell.dcol;
+        }
+
+        if (ref_row < 0 || (size_t) ref_row >= table->rows ||
+            ref_col < 0 || (size_t) ref_col >= table->cols) {
+            String_Builder sb = {0};
+            sb_append_cell_name(&sb, row, col);
+            sb_append(&sb, " refers to ", 11);
+            if (ref_row >= 0 && ref_col >= 0) {
+                sb_append_cell_name(&sb, (size_t) ref_row, (size_t) ref_col);
+            } else {
+                sb_append(&sb, "a cell", 6);
+            }
+            fprintf(stderr, "ERROR: %.*s outside of the table\n", (int) sb.count, sb.items);
+            free(sb.items);
+            return 1;
+        }
+
+        // The relative references are shared by all the copies, so only
+        // the absolute ones can be linked to a single cell. The cells past
+        // the end of a row of a ragged table are all the same empty cell,
+        // which has no position to report the reference with, so such
+        // references stay as they are.
+        bool past_end = table->row_offsets &&
+                        table->row_offsets[ref_row] + (size_t) ref_col >= table->row_offsets[ref_row + 1];
+        if (expr->kind == EXPR_KIND_CELL && !past_end) {
+            expr->kind = EXPR_KIND_CELL_INDEX;
+            expr->as.cell_index = table_cell_index(table, (size_t) ref_row, (size_t) ref_col);
+        }
+        return 0;
+    }
+
+    case EXPR_KIND_PLUS: {
+        Expr_Index lhs = expr->as.plus.lhs;
+        Expr_Index rhs = expr->as.plus.rhs;
+        return table_link_expr(table, eb, lhs, row, col) + table_link_expr(table, eb, rhs, row, col);
+    }
+    }
+
+    return 0;
+}
+
+void table_link_refs(Table *table, Expr_Buffer *eb)
+{
+    // The copies are resolved first since they turn the references of the
+    // copied formulas into relative ones
+    for (size_t row = 0; row < table->rows; ++row) {
+        paged_tick(table->cols * sizeof(Cell));
+        for (size_t col = 0; col < table->cols; ++col) {
+            if (table_cell_at(table, row, col)->kind == CELL_KIND_CLONE) {
+                table_resolve_clone(table, eb, row, col);
+            }
+        }
+    }
+
+    size_t errors = 0;
+    for (size_t row = 0; row < table->rows; ++row) {
+        paged_tick(table->cols * sizeof(Cell));
+        for (size_t col = 0; col < table->cols; ++col) {
+            Cell *cell = table_cell_at(table, row, col);
+            if (cell->kind == CELL_KIND_EXPR) {
+                errors += table_link_expr(table, eb, cell->index, row, col);
+            }
+        }
+    }
+
+    if (errors > 0) {
+        fprintf(stderr, "ERROR: %zu reference%s outside of the table\n", errors, errors == 1 ? " is" : "s are");
+        input_error();
+    }
+}
+
+// Type checking
+//
+// After the references are linked every formula is checked to depend only
+// on numbers and other formulas. All the text cells that participate in
+// the formulas and all the circular dependencies are reported up front.
+// The check also sorts the formulas so that each one comes after all the
+// formulas it depends on, which lets table_eval_ordered() evaluate them
+// without looking at the kinds and the statuses of the cells.
+
+typedef enum {
+    TYPE_UNKNOWN = 0,
+    TYPE_CHECKING,
+    TYPE_NUMBER,
+    TYPE_ERROR,
+} Cell_Type;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    size_t *items;
+} Index_Array;
+
+void index_array_push(Index_Array *array, size_t index)
+{
+    if (array->count >= array->capacity) {
+        array->capacity = array->capacity == 0 ? 256 : array->capacity * 2;
+        array->items = realloc(array->items, sizeof(*array->items) * array->capacity);
+        assert(array->items != NULL && "Buy more RAM lol");
+    }
+    array->items[array->count++] = index;
+}
+
+// A cell that a formula refers to, together with the reference itself
+// for the error messages
+typedef struct {
+    size_t cell;
+    Expr_Index expr;
+} Check_Ref;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Check_Ref *items;
+} Check_Refs;
+
+// Appends the cells that the linked expression hosted by the cell
+// (row, col) refers to
+void append_expr_refs(Table *table, Expr_Buffer *eb, Expr_Index expr_index, size_t row, size_t col, Check_Refs *refs)
+{
+    Expr *expr = expr_buffer_at(eb, expr_index);
+
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+        break;
+
+    case EXPR_KIND_CELL:
+    case EXPR_KIND_CELL_INDEX:
+    case EXPR_KIND_REL_CELL: {
+        if (refs->count >= refs->capacity) {
+            refs->capacity = refs->capacity == 0 ? 256 : refs->capacity * 2;
+            refs->items = realloc(refs->items, sizeof(*refs->items) * refs->capacity);
+            assert(refs->items != NULL && "Buy more RAM lol");
+        }
+
+        Check_Ref *ref = &refs->items[refs->count++];
+        ref->expr = expr_index;
+        if (expr->kind == EXPR_KIND_CELL) {
+            ref->cell = table_cell_index(table, expr->as.cell.row, expr->as.cell.col);
+        } else if (expr->kind == EXPR_KIND_CELL_INDEX) {
+            ref->cell = expr->as.cell_index;
+        } else {
+            ref->cell = table_cell_index(table,
+                                         (size_t) ((ptrdiff_t) row + expr->as.rel_cell.drow),
+                                         (size_t) ((ptrdiff_t) col + expr->as.rel_cell.dcol));
+        }
+    }
+    break;
+
+    case EXPR_KIND_PLUS: {
+        Expr_Index lhs = expr->as.plus.lhs;
+        Expr_Index rhs = expr->as.plus.rhs;
+        append_expr_refs(table, eb, lhs, row, col, refs);
+        append_expr_refs(table, eb, rhs, row, col, refs);
+    }
+    break;
+    }
+}
+
+void report_ref_error(Table *table, Expr_Buffer *eb, size_t row, size_t col, const char *message, Expr_Index ref)
+{
+    size_t ref_row, ref_col;
+    expr_cell_position(table, expr_buffer_at(eb, ref), row, col, &ref_row, &ref_col);
+
+    String_Builder sb = {0};
+    sb_append_cell_name(&sb, row, col);
+    sb_append(&sb, ": ", 2);
+    sb_append(&sb, message, strlen(message));
+    sb_append(&sb, " ", 1);
+    sb_append_cell_name(&sb, ref_row, ref_col);
+    fprintf(stderr, "ERROR: %.*s\n", (int) sb.count, sb.items);
+    free(sb.items);
+}
+
+typedef struct {
+    size_t cell;
+    size_t row;
+    size_t col;
+    size_t refs_begin;
+    size_t refs_end;
+    size_t next_ref;
+    bool failed;
+} Check_Frame;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Check_Frame *items;
+} Check_Frames;
+
+void check_frames_push(Check_Frames *frames, Table *table, Expr_Buffer *eb, Check_Refs *refs,
+                       unsigned char *types, size_t cell)
+{
+    if (frames->count >= frames->capacity) {
+        frames->capacity = frames->capacity == 0 ? 256 : frames->capacity * 2;
+        frames->items = realloc(frames->items, sizeof(*frames->items) * frames->capacity);
+        assert(frames->items != NULL && "Buy more RAM lol");
+    }
+
+    Check_Frame *frame = &frames->items[frames->count++];
+    memset(frame, 0, sizeof(*frame));
+    frame->cell = cell;
+    table_cell_position(table, cell, &frame->row, &frame->col);
+    frame->refs_begin = refs->count;
+    append_expr_refs(table, eb, table->cells[cell].index, frame->row, frame->col, refs);
+    frame->refs_end = refs->count;
+    frame->next_ref = frame->refs_begin;
+    types[cell] = TYPE_CHECKING;
+}
+
+// Returns the indices of all the formulas in the order of evaluation
+Index_Array table_check_types(Table *table, Expr_Buffer *eb)
+{
+    size_t cells_count = table_cells_count(table);
+    unsigned char *types = paged_calloc(cells_count, sizeof(*types));
+    assert(types != NULL && "Buy more RAM lol");
+
+    Index_Array order = {0};
+    if (max_memory > 0) {
+        // There are never more formulas than cells, and the part of the
+        // file that is never written takes no space
+        order.capacity = cells_count > 0 ? cells_count : 1;
+        order.items = paged_calloc(order.capacity, sizeof(*order.items));
+    }
+    Check_Refs refs = {0};
+    Check_Frames frames = {0};
+    size_t errors = 0;
+
+    // Depth-first search without recursion, since the chains of formulas
+    // may be as long as the table
+    for (size_t root = 0; root < cells_count; ++root) {
+        paged_tick(sizeof(Cell));
+        if (table->cells[root].kind != CELL_KIND_EXPR || types[root] != TYPE_UNKNOWN) {
+            continue;
+        }
+
+        check_frames_push(&frames, table, eb, &refs, types, root);
+        while (frames.count > 0) {
+            Check_Frame *frame = &frames.items[frames.count - 1];
+
+            if (frame->next_ref < frame->refs_end) {
+                Check_Ref *check_ref = &refs.items[frame->next_ref++];
+                size_t ref = check_ref->cell;
+                Cell *cell = &table->cells[ref];
+                switch (cell->kind) {
+                case CELL_KIND_NUMBER:
+                    break;
+
+                case CELL_KIND_TEXT:
+                    report_ref_error(table, eb, frame->row, frame->col, "text cells may not participate in math expressions:", check_ref->expr);
+                    errors += 1;
+                    frame->failed = true;
+                    break;
+
+                case CELL_KIND_EXPR:
+                    if (types[ref] == TYPE_UNKNOWN) {
+                        check_frames_push(&frames, table, eb, &refs, types, ref);
+                    } else if (types[ref] == TYPE_CHECKING) {
+                        report_ref_error(table, eb, frame->row, frame->col, "circular dependency is detected through", check_ref->expr);
+                        errors += 1;
+                        frame->failed = true;
+                    } else if (types[ref] == TYPE_ERROR) {
+                        frame->failed = true;
+                    }
+                    break;
+
+                case CELL_KIND_CLONE:
+                    assert(0 && "the copies are resolved before the type check");
+                    exit(1);
+
+                case CELL_KIND_RAW:
+                    assert(0 && "the table is parsed before the type check");
+                    exit(1);
+                }
+                continue;
+            }
+
+            types[frame->cell] = frame->failed ? TYPE_ERROR : TYPE_NUMBER;
+            if (!frame->failed) {
+                index_array_push(&order, frame->cell);
+            }
+            refs.count = frame->refs_begin;
+            frames.count -= 1;
+            if (frame->failed && frames.count > 0) {
+                frames.items[frames.count - 1].failed = true;
+            }
+        }
+    }
+
+    paged_free(types);
+    free(refs.items);
+    free(frames.items);
+
+    if (errors > 0) {
+        free(order.items);
+        fprintf(stderr, "ERROR: %zu error%s in the formulas\n", errors, errors == 1 ? "" : "s");
+        input_error();
+    }
+
+    return order;
+}
+
+// Evaluates a checked formula hosted by the cell (row, col) whose inputs
+// have been evaluated already
+double table_eval_numeric(Table *table, Expr_Buffer *eb, Expr_Index expr_index, size_t row, size_t col)
+{
+    Expr *expr = expr_buffer_at(eb, expr_index);
+
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+        return expr->as.number;
+
+    case EXPR_KIND_CELL_INDEX:
+        return table->cells[expr->as.cell_index].number;
+
+    case EXPR_KIND_REL_CELL:
+        return table->cells[table_cell_index(table,
+                                             (size_t) ((ptrdiff_t) row + expr->as.rel_cell.drow),
+                                             (size_t) ((ptrdiff_t) col + expr->as.rel_cell.dcol))].number;
+
+    case EXPR_KIND_PLUS:
+        return table_eval_numeric(table, eb, expr->as.plus.lhs, row, col) +
+               table_eval_numeric(table, eb, expr->as.plus.rhs, row, col);
+
+    case EXPR_KIND_CELL:
+        assert(0 && "the references are linked before the evaluation");
+        exit(1);
+    }
+
+    return 0;
+}
+
+void table_eval_ordered(Table *table, Expr_Buffer *eb, const Index_Array *order)
+{
+    for (size_t i = 0; i < order->count; ++i) {
+        paged_tick(sizeof(Cell) + sizeof(Expr));
+        Cell *cell = &table->cells[order->items[i]];
+        size_t row, col;
+        table_cell_position(table, order->items[i], &row, &col);
+        cell->value = table_eval_numeric(table, eb, cell->index, row, col);
+        cell->status = EVALUATED;
+    }
+
+    if (order->count > 0 && stats.max_eval_depth < 1) {
+        stats.max_eval_depth = 1;
+    }
+}
+
+// Row index (--index)
+//
+// The index is a file next to the input (input.csv.idx) with the byte
+// offset of every line and the number of cells before every row, so later
+// runs know the shape of the table without scanning the input and go
+// straight to the rows they need. It is in the native byte order. The
+// index is stale once the size or the modification time of the input
+// changes, or the hash of its first and last INDEX_HASH_SAMPLE bytes.
+// Hashing the whole input would cost as much as the scan the index saves.
+
+#define INDEX_MAGIC 0x3158444e49434d00ULL
+#define INDEX_HASH_SAMPLE (64 * 1024)
+
+typedef struct {
+    uint64_t magic;
+    uint64_t input_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t sample_hash;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t cells;
+    // Followed by size_t line_offsets[rows + 1] and size_t cell_offsets[rows + 1]
+} Index_Header;
+
+typedef struct {
+    char *data;
+    size_t size;
+    const Index_Header *header;
+    const size_t *line_offsets;
+    // Same as Table.row_offsets of a ragged table
+    const size_t *cell_offsets;
+} Row_Index;
+
+uint64_t index_sample_hash(String_View content)
+{
+    if (content.count <= 2 * INDEX_HASH_SAMPLE) {
+        return intern_hash(content);
+    }
+
+    String_View head = {.count = INDEX_HASH_SAMPLE, .data = content.data};
+    String_View tail = {.count = INDEX_HASH_SAMPLE, .data = content.data + content.count - INDEX_HASH_SAMPLE};
+    return intern_hash(head) * 31 + intern_hash(tail);
+}
+
+void index_header_init(Index_Header *header, String_View content, const struct stat *st)
+{
+    memset(header, 0, sizeof(*header));
+    header->magic = INDEX_MAGIC;
+    header->input_size = content.count;
+    header->mtime_sec = (int64_t) st->st_mtim.tv_sec;
+    header->mtime_nsec = (int64_t) st->st_mtim.tv_nsec;
+    header->sample_hash = index_sample_hash(content);
+}
+
+bool index_build(const char *index_path, String_View content, const struct stat *st)
+{
+    Index_Header header;
+    index_header_init(&header, content, st);
+
+    Index_Array line_offsets = {0};
+    Index_Array cell_offsets = {0};
+    String_View rest = content;
+    while (rest.count > 0) {
+        index_array_push(&line_offsets, (size_t) (rest.data - content.data));
+        index_array_push(&cell_offsets, header.cells);
+
+        String_View line = csv_chop_by_delim(&rest, '\n');
+        size_t col = 0;
+        for (; line.count > 0; ++col) {
+            csv_chop_by_delim(&line, '|');
+        }
+
+        if (header.cols < col) {
+            header.cols = col;
+        }
+        header.cells += col;
+        header.rows += 1;
+    }
+    index_array_push(&line_offsets, content.count);
+    index_array_push(&cell_offsets, header.cells);
+
+    bool ok = false;
+    FILE *f = fopen(index_path, "wb");
+    if (f != NULL) {
+        ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(line_offsets.items, sizeof(*line_offsets.items), line_offsets.count, f) == line_offsets.count &&
+             fwrite(cell_offsets.items, sizeof(*cell_offsets.items), cell_offsets.count, f) == cell_offsets.count;
+        ok = fclose(f) == 0 && ok;
+        if (!ok) {
+            remove(index_path);
+        }
+    }
+
+    free(line_offsets.items);
+    free(cell_offsets.items);
+    return ok;
+}
+
+// Returns false when there is no index or it is stale
+bool index_open(Row_Index *index, const char *index_path, String_View content, const struct stat *st)
+{
+    memset(index, 0, sizeof(*index));
+    index->data = map_file(index_path, &index->size);
+    if (index->data == NULL) {
+        return false;
+    }
+
+    Index_Header expected;
+    index_header_init(&expected, content, st);
+
+    const Index_Header *header = (const Index_Header *) index->data;
+    bool fresh = index->size >= sizeof(*header) &&
+                 header->magic == expected.magic &&
+                 header->input_size == expected.input_size &&
+                 header->mtime_sec == expected.mtime_sec &&
+                 header->mtime_nsec == expected.mtime_nsec &&
+                 header->sample_hash == expected.sample_hash &&
+                 index->size == sizeof(*header) + 2 * (header->rows + 1) * sizeof(size_t);
+    if (!fresh) {
+        unmap_file(index->data, index->size);
+        memset(index, 0, sizeof(*index));
+        return false;
+    }
+
+    index->header = header;
+    index->line_offsets = (const size_t *) (index->data + sizeof(*header));
+    index->cell_offsets = index->line_offsets + header->rows + 1;
+    return true;
+}
+
+void index_close(Row_Index *index)
+{
+    if (index->data != NULL) {
+        unmap_file(index->data, index->size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+// Splits the row into cells that are parsed once they are needed (see
+// table_load_raw_cell())
+void table_load_row(Table *table, size_t row)
+{
+    table->rows_loaded[row] = true;
+
+    String_View line = {
+        .count = table->line_offsets[row + 1] - table->line_offsets[row],
+        .data = table->content + table->line_offsets[row],
+    };
+    line = csv_chop_by_delim(&line, '\n');
+    for (size_t col = 0; line.count > 0; ++col) {
+        Cell *cell = table_cell_at(table, row, col);
+        cell->kind = CELL_KIND_RAW;
+        cell_set_text(cell, sv_trim(csv_chop_by_delim(&line, '|')));
+    }
+}
+
+// Selected cells (--cells)
+//
+// Instead of the whole table only the selected cells are evaluated,
+// together with the cells they depend on. The formulas are parsed lazily,
+// so the formulas outside of the dependencies are never even parsed.
+
+typedef struct {
+    size_t row_begin;
+    size_t col_begin;
+    // Inclusive
+    size_t row_end;
+    size_t col_end;
+} Cell_Range;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Cell_Range *items;
+} Cell_Ranges;
+
+bool is_upper(char c)
+{
+    return isupper(c);
+}
+
+bool is_digit(char c)
+{
+    return isdigit(c);
+}
+
+// Parses a column name like `A` or `AB`
+bool parse_column_name(String_View *sv, size_t *out_col)
+{
+    String_View letters = sv_chop_left_while(sv, is_upper);
+    if (letters.count == 0) {
+        return false;
+    }
+
+    size_t col = 0;
+    for (size_t i = 0; i < letters.count; ++i) {
+        col = col * 26 + (size_t) (letters.data[i] - 'A' + 1);
+    }
+
+    *out_col = col - 1;
+    return true;
+}
+
+// Parses a cell name like `A5` or `AB10`
+bool parse_cell_name(String_View *sv, size_t *out_row, size_t *out_col)
+{
+    size_t col = 0;
+    if (!parse_column_name(sv, &col)) {
+        return false;
+    }
+
+    String_View digits = sv_chop_left_while(sv, is_digit);
+    if (digits.count == 0) {
+        return false;
+    }
+
+    size_t row = 0;
+    for (size_t i = 0; i < digits.count; ++i) {
+        row = row * 10 + (size_t) (digits.data[i] - '0');
+    }
+
+    *out_row = row;
+    *out_col = col;
+    return true;
+}
+
+// Parses a comma separated list of cells and ranges like `A5,C10,A1:B3`
+bool parse_cell_ranges(const char *cstr, Cell_Ranges *ranges)
+{
+    String_View sv = sv_from_cstr(cstr);
+    while (sv.count > 0) {
+        String_View item = sv_chop_by_delim(&sv, ',');
+
+        Cell_Range range = {0};
+        if (!parse_cell_name(&item, &range.row_begin, &range.col_begin)) {
+            return false;
+        }
+        range.row_end = range.row_begin;
+        range.col_end = range.col_begin;
+
+        if (sv_starts_with(item, SV(":"))) {
+            sv_chop_left(&item, 1);
+            if (!parse_cell_name(&item, &range.row_end, &range.col_end) ||
+                range.row_end < range.row_begin || range.col_end < range.col_begin) {
+                return false;
+            }
+        }
+
+        if (item.count > 0) {
+            return false;
+        }
+
+        if (ranges->count >= ranges->capacity) {
+            ranges->capacity = ranges->capacity == 0 ? 16 : ranges->capacity * 2;
+            ranges->items = realloc(ranges->items, sizeof(*ranges->items) * ranges->capacity);
+            assert(ranges->items != NULL && "Buy more RAM lol");
+        }
+        ranges->items[ranges->count++] = range;
+    }
+
+    return ranges->count > 0;
+}
+
+void table_eval_selection(Table *table, Expr_Buffer *eb, const Cell_Ranges *ranges)
+{
+    for (size_t i = 0; i < ranges->count; ++i) {
+        const Cell_Range *range = &ranges->items[i];
+        if (range->row_end >= table->rows || range->col_end >= table->cols) {
+            String_Builder sb = {0};
+            sb_append_cell_name(&sb, range->row_end, range->col_end);
+            fprintf(stderr, "ERROR: selected cell %.*s is outside of the table\n", (int) sb.count, sb.items);
+            exit(1);
+        }
+    }
+
+    for (size_t i = 0; i < ranges->count; ++i) {
+        const Cell_Range *range = &ranges->items[i];
+        for (size_t row = range->row_begin; row <= range->row_end; ++row) {
+            for (size_t col = range->col_begin; col <= range->col_end; ++col) {
+                table_eval_cell(table, eb, row, col);
+            }
+        }
+    }
+}
+
+// Every row of every range goes on its own line
+void table_dump_selection(FILE *stream, Table *table, const Cell_Ranges *ranges)
+{
+    String_Builder sb = {0};
+    for (size_t i = 0; i < ranges->count; ++i) {
+        const Cell_Range *range = &ranges->items[i];
+        for (size_t row = range->row_begin; row <= range->row_end; ++row) {
+            for (size_t col = range->col_begin; col <= range->col_end; ++col) {
+                sb_append_cell(&sb, table_cell_at(table, row, col));
+                if (col < range->col_end) {
+                    sb_append(&sb, "|", 1);
+                }
+            }
+            sb_append(&sb, "\n", 1);
+        }
+    }
+    fwrite(sb.items, 1, sb.count, stream);
+    free(sb.items);
+}
+
+// Column projection (--columns)
+//
+// Only the projected columns are parsed, evaluated and written. The cells
+// of the other columns keep their text as CELL_KIND_RAW and are parsed
+// once a formula refers to them, so the only other columns that get
+// parsed are the ones the projection depends on.
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    size_t *items;
+} Columns;
+
+void columns_push(Columns *columns, size_t col)
+{
+    if (columns->count >= columns->capacity) {
+        columns->capacity = columns->capacity == 0 ? 16 : columns->capacity * 2;
+        columns->items = realloc(columns->items, sizeof(*columns->items) * columns->capacity);
+        assert(columns->items != NULL && "Buy more RAM lol");
+    }
+    columns->items[columns->count++] = col;
+}
+
+// Parses a comma separated list of columns and ranges like `A,C:E`
+bool parse_columns(const char *cstr, Columns *columns)
+{
+    String_View sv = sv_from_cstr(cstr);
+    while (sv.count > 0) {
+        String_View item = sv_chop_by_delim(&sv, ',');
+
+        size_t begin = 0;
+        if (!parse_column_name(&item, &begin)) {
+            return false;
+        }
+        size_t end = begin;
+
+        if (sv_starts_with(item, SV(":"))) {
+            sv_chop_left(&item, 1);
+            if (!parse_column_name(&item, &end) || end < begin) {
+                return false;
+            }
+        }
+
+        if (item.count > 0) {
+            return false;
+        }
+
+        for (size_t col = begin; col <= end; ++col) {
+            columns_push(columns, col);
+        }
+    }
+
+    return columns->count > 0;
+}
+
+void table_eval_projection(Table *table, Expr_Buffer *eb, const Columns *columns)
+{
+    for (size_t row = 0; row < table->rows; ++row) {
+        for (size_t i = 0; i < columns->count; ++i) {
+            table_eval_cell(table, eb, row, columns->items[i]);
+        }
+    }
+}
+
+void table_dump_projection(FILE *stream, Table *table, const Columns *columns)
+{
+    String_Builder sb = {0};
+    for (size_t row = 0; row < table->rows; ++row) {
+        for (size_t i = 0; i < columns->count; ++i) {
+            sb_append_cell(&sb, table_cell_at(table, row, columns->items[i]));
+            if (i < columns->count - 1) {
+                sb_append(&sb, "|", 1);
+            }
+        }
+        sb_append(&sb, "\n", 1);
+
+        if (sb.count >= TEXT_FLUSH_SIZE) {
+            TRACE_BEGIN("flush");
+            fwrite(sb.items, 1, sb.count, stream);
+            TRACE_END("flush");
+            sb.count = 0;
+        }
+    }
+    TRACE_BEGIN("flush");
+    fwrite(sb.items, 1, sb.count, stream);
+    TRACE_END("flush");
+    free(sb.items);
+}
+
+// Pipelined execution (--pipeline)
+//
+//   reader -> parser -> evaluator -> writer
+//
+// Every stage is a thread and the stages are connected by bounded
+// single-producer/single-consumer rings, so a stage that gets ahead of
+// the next one waits until there is room again, first spinning for a
+// while and then sleeping on a condition variable. The reader cuts the
+// input into blocks of whole lines, the parser turns every block into a
+// batch of rows with its own expressions, the evaluator links the
+// batches into one row-by-row table and evaluates the rows in order as
+// soon as everything they reference has arrived, and the writer formats
+// the finished batches. Since the width of the table is not known up
+// front every row is written with its own number of cells.
+
+#define RING_CAPACITY 16
+// The number of times a stage checks a full or an empty ring again before
+// it goes to sleep until the other stage pops or pushes
+#define RING_SPINS 64
+
+typedef struct {
+    void *items[RING_CAPACITY];
+    atomic_size_t head;
+    atomic_size_t tail;
+    // The number of stages sleeping on `changed`, so the stage on the other
+    // side only takes the lock when there is somebody to wake up
+    atomic_size_t sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Ring;
+
+void ring_init(Ring *ring)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->sleepers, 0);
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->changed, NULL);
+}
+
+void ring_destroy(Ring *ring)
+{
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->changed);
+}
+
+// Waits until `counter` moves away from `value`. The sleepers are counted
+// and the counter is checked again under the lock with sequentially
+// consistent operations, so either the waiting stage sees the new value
+// or ring_wake() sees the sleeper.
+void ring_wait(Ring *ring, atomic_size_t *counter, size_t value)
+{
+    for (size_t i = 0; i < RING_SPINS; ++i) {
+        if (atomic_load_explicit(counter, memory_order_acquire) != value) {
+            return;
+        }
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    atomic_fetch_add(&ring->sleepers, 1);
+    while (atomic_load(counter) == value) {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    atomic_fetch_sub(&ring->sleepers, 1);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void ring_wake(Ring *ring)
+{
+    if (atomic_load(&ring->sleepers) > 0) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->changed);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+void ring_push(Ring *ring, void *item)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring_wait(ring, &ring->head, tail - RING_CAPACITY);
+    ring->items[tail % RING_CAPACITY] = item;
+    atomic_store(&ring->tail, tail + 1);
+    ring_wake(ring);
+}
+
+void *ring_pop(Ring *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring_wait(ring, &ring->tail, head);
+    void *item = ring->items[head % RING_CAPACITY];
+    atomic_store(&ring->head, head + 1);
+    ring_wake(ring);
+    return item;
+}
+
+typedef struct {
+    char *memory;
+    char *data;
+    size_t count;
+    Cell *cells;
+    size_t cells_count;
+    size_t cells_capacity;
+    Row *rows;
+    size_t rows_count;
+    size_t rows_capacity;
+    Expr_Buffer eb;
+} Batch;
+
+typedef struct {
+    int input;
+    FILE *output;
+    // The parser leaves the formulas to the evaluator (--lazy), which is
+    // the only thread that touches the shared Expr_Buffer
+    bool lazy;
+    size_t bytes_read;
+    Ring blocks;
+    Ring batches;
+    Ring evaluated;
+} Pipeline;
+
+#define PIPELINE_HEADROOM (64 * 1024)
+
+void *pipeline_read(void *arg)
+{
+    Pipeline *p = arg;
+    TRACE_THREAD_NAME("reader");
+
+    Block_Reader r;
+    block_reader_open(&r, p->input, PIPELINE_HEADROOM);
+
+    // The unfinished last line of the previous batch. It stays in the
+    // memory of that batch, which lives until the end of the pipeline.
+    const char *tail = NULL;
+    size_t tail_count = 0;
+    for (;;) {
+        size_t count = 0;
+        TRACE_BEGIN("read block");
+        char *buffer = block_reader_next(&r, &count);
+        TRACE_END("read block");
+        bool eof = count == 0;
+        p->bytes_read += count;
+
+        Batch *batch = malloc(sizeof(*batch));
+        memset(batch, 0, sizeof(*batch));
+        if (tail_count <= PIPELINE_HEADROOM) {
+            batch->memory = buffer;
+            batch->data = buffer + PIPELINE_HEADROOM - tail_count;
+        } else {
+            batch->memory = malloc(tail_count + count);
+            memcpy(batch->memory + tail_count, buffer + PIPELINE_HEADROOM, count);
+            free(buffer);
+            batch->data = batch->memory;
+        }
+        if (tail_count > 0) {
+            memcpy(batch->data, tail, tail_count);
+        }
+        batch->count = tail_count + count;
+
+        if (!eof) {
+            // Hand over only whole lines and carry the rest over to the
+            // next block. The lines are found from the start of the batch
+            // since a newline may be inside of a quoted field.
+            size_t end = 0;
+            size_t i = 0;
+            String_View rest = {
+                .count = batch->count,
+                .data = batch->data,
+            };
+            while (csv_index_of(rest, '\n', &i)) {
+                end += i + 1;
+                sv_chop_left(&rest, i + 1);
+            }
+            tail = batch->data + end;
+            tail_count = batch->count - end;
+            batch->count = end;
+        }
+
+        if (batch->count > 0 || !eof) {
+            // Even without a single whole line the batch is handed over
+            // to keep the memory of the tail alive
+            ring_push(&p->blocks, batch);
+        } else {
+            free(batch->memory);
+            free(batch);
+        }
+
+        if (eof) {
+            break;
+        }
+    }
+
+    block_reader_close(&r);
+    ring_push(&p->blocks, NULL);
+    return NULL;
+}
+
+void *pipeline_parse(void *arg)
+{
+    Pipeline *p = arg;
+    TRACE_THREAD_NAME("parser");
+    Tmp_Cstr tc = {0};
+
+    Batch *batch;
+    while ((batch = ring_pop(&p->blocks)) != NULL) {
+        TRACE_BEGIN("parse batch");
+        String_View content = {
+            .count = batch->count,
+            .data = batch->data,
+        };
+
+        while (content.count > 0) {
+            String_View line = csv_chop_by_delim(&content, '\n');
+            size_t begin = batch->cells_count;
+            while (line.count > 0) {
+                String_View cell_value = sv_trim(csv_chop_by_delim(&line, '|'));
+                if (batch->cells_count >= batch->cells_capacity) {
+                    batch->cells_capacity = batch->cells_capacity == 0 ? 1024 : batch->cells_capacity * 2;
+                    batch->cells = realloc(batch->cells, sizeof(*batch->cells) * batch->cells_capacity);
+                }
+                Cell *cell = &batch->cells[batch->cells_count++];
+                memset(cell, 0, sizeof(*cell));
+                if (p->lazy && sv_starts_with(cell_value, SV("="))) {
+                    // The text stays in the memory of the batch until the end of the pipeline
+                    sv_chop_left(&cell_value, 1);
+                    cell->kind = CELL_KIND_EXPR;
+                    cell_set_source(cell, cell_value);
+                    cell->status = UNPARSED;
+                    continue;
+                }
+                parse_cell(cell, &batch->eb, &tc, cell_value);
+            }
+
+            if (batch->rows_count >= batch->rows_capacity) {
+                batch->rows_capacity = batch->rows_capacity == 0 ? 256 : batch->rows_capacity * 2;
+                batch->rows = realloc(batch->rows, sizeof(*batch->rows) * batch->rows_capacity);
+            }
+            // Offsets for now, the cells may still move
+            batch->rows[batch->rows_count].cells = NULL;
+            batch->rows[batch->rows_count].count = batch->cells_count - begin;
+            batch->rows_count += 1;
+        }
+
+        Cell *cells = batch->cells;
+        for (size_t i = 0; i < batch->rows_count; ++i) {
+            batch->rows[i].cells = cells;
+            cells += batch->rows[i].count;
+        }
+
+        TRACE_END("parse batch");
+        ring_push(&p->batches, batch);
+    }
+
+    ring_push(&p->batches, NULL);
+    free(tc.cstr);
+    return NULL;
+}
+
+void *pipeline_write(void *arg)
+{
+    Pipeline *p = arg;
+    TRACE_THREAD_NAME("writer");
+    String_Builder sb = {0};
+
+    Batch *batch;
+    while ((batch = ring_pop(&p->evaluated)) != NULL) {
+        for (size_t i = 0; i < batch->rows_count; ++i) {
+            Row *row = &batch->rows[i];
+            for (size_t col = 0; col < row->count; ++col) {
+                sb_append_cell(&sb, &row->cells[col]);
+                if (col < row->count - 1) {
+                    sb_append(&sb, "|", 1);
+                }
+            }
+            sb_append(&sb, "\n", 1);
+
+            if (sb.count >= TEXT_FLUSH_SIZE) {
+                TRACE_BEGIN("flush");
+                fwrite(sb.items, 1, sb.count, p->output);
+                TRACE_END("flush");
+                sb.count = 0;
+            }
+        }
+    }
+
+    TRACE_BEGIN("flush");
+    fwrite(sb.items, 1, sb.count, p->output);
+    TRACE_END("flush");
+    free(sb.items);
+    return NULL;
+}
+
+// Moves the expressions of the batch into the shared buffer
+void batch_link_exprs(Batch *batch, Expr_Buffer *eb)
+{
+    Expr_Index base = eb->count;
+    for (size_t i = 0; i < batch->eb.count; ++i) {
+        Expr *expr = expr_buffer_at(eb, expr_buffer_alloc(eb));
+        *expr = batch->eb.items[i];
+        if (expr->kind == EXPR_KIND_PLUS) {
+            expr->as.plus.lhs += base;
+            expr->as.plus.rhs += base;
+        }
+    }
+
+    for (size_t i = 0; i < batch->cells_count; ++i) {
+        if (batch->cells[i].kind == CELL_KIND_EXPR && batch->cells[i].status != UNPARSED) {
+            batch->cells[i].index += base;
+        }
+    }
+
+    free(batch->eb.items);
+    memset(&batch->eb, 0, sizeof(batch->eb));
+}
+
+bool table_cell_is_ready(Table *table, Expr_Buffer *eb, size_t row, size_t col);
+
+// Whether every cell the expression depends on has been loaded already
+bool table_expr_is_ready(Table *table, Expr_Buffer *eb, Expr_Index expr_index, size_t row, size_t col)
+{
+    Expr *expr = expr_buffer_at(eb, expr_index);
+
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+        return true;
+
+    case EXPR_KIND_CELL:
+    case EXPR_KIND_REL_CELL:
+    case EXPR_KIND_CELL_INDEX: {
+        size_t ref_row, ref_col;
+        expr_cell_position(table, expr, row, col, &ref_row, &ref_col);
+        return table_cell_is_ready(table, eb, ref_row, ref_col);
+    }
+
+    case EXPR_KIND_PLUS: {
+        // The left side may parse formulas and move the Expr_Buffer (--lazy)
+        Expr_Index rhs = expr->as.plus.rhs;
+        return table_expr_is_ready(table, eb, expr->as.plus.lhs, row, col) &&
+               table_expr_is_ready(table, eb, rhs, row, col);
+    }
+    }
+
+    return true;
+}
+
+bool table_cell_is_ready(Table *table, Expr_Buffer *eb, size_t row, size_t col)
+{
+    if (row >= table->rows) {
+        return false;
+    }
+
+    Cell *cell = table_cell_at(table, row, col);
+    if (cell->kind == CELL_KIND_CLONE) {
+        // The copy can be resolved once the copied cell is loaded. Circular
+        // copies and copies from outside of the table are reported by
+        // table_resolve_clone().
+        bool loaded = true;
+        size_t r = row;
+        size_t c = col;
+        Cell *src = cell;
+        while (src->kind == CELL_KIND_CLONE && !src->resolving) {
+            src->resolving = true;
+            if (!table_neighbor(table, r, c, src->dir, &r, &c)) {
+                loaded = src->dir != DIR_DOWN;
+                break;
+            }
+            src = table_cell_at(table, r, c);
+        }
+
+        r = row;
+        c = col;
+        src = cell;
+        while (src->kind == CELL_KIND_CLONE && src->resolving) {
+            src->resolving = false;
+            if (!table_neighbor(table, r, c, src->dir, &r, &c)) {
+                break;
+            }
+            src = table_cell_at(table, r, c);
+        }
+
+        if (!loaded) {
+            return false;
+        }
+        table_resolve_clone(table, eb, row, col);
+    }
+
+    if (cell->kind == CELL_KIND_EXPR && cell->status == UNPARSED) {
+        table_parse_lazy_cell(eb, cell);
+    }
+
+    if (cell->kind != CELL_KIND_EXPR || cell->status != UNEVALUATED) {
+        // Circular dependencies are reported by table_eval_cell()
+        return true;
+    }
+
+    cell->status = INPROGRESS;
+    bool ready = table_expr_is_ready(table, eb, cell->index, row, col);
+    cell->status = UNEVALUATED;
+    return ready;
+}
+
+bool table_row_is_ready(Table *table, Expr_Buffer *eb, size_t row)
+{
+    for (size_t col = 0; col < table->row_items[row].count; ++col) {
+        if (!table_cell_is_ready(table, eb, row, col)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void pipeline_run(int input, FILE *output, bool lazy)
+{
+    Pipeline *p = malloc(sizeof(*p));
+    memset(p, 0, sizeof(*p));
+    p->input = input;
+    p->output = output;
+    p->lazy = lazy;
+    ring_init(&p->blocks);
+    ring_init(&p->batches);
+    ring_init(&p->evaluated);
+
+    void *(*stages[])(void *) = {pipeline_read, pipeline_parse, pipeline_write};
+    pthread_t threads[sizeof(stages) / sizeof(stages[0])];
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i) {
+        int err = pthread_create(&threads[i], NULL, stages[i], p);
+        if (err != 0) {
+            fprintf(stderr, "ERROR: could not create a thread: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+
+    Table table = {0};
+    size_t rows_capacity = 0;
+    Expr_Buffer eb = {0};
+
+    Batch **batches = NULL;
+    size_t batches_count = 0;
+    size_t batches_written = 0;
+    size_t next_row = 0;
+    // The first row of every batch that is not written yet
+    size_t batch_end = 0;
+
+    for (;;) {
+        Batch *batch = ring_pop(&p->batches);
+        bool eof = batch == NULL;
+
+        TRACE_BEGIN("eval batch");
+        if (!eof) {
+            batch_link_exprs(batch, &eb);
+            if (table.rows + batch->rows_count > rows_capacity) {
+                while (table.rows + batch->rows_count > rows_capacity) {
+                    rows_capacity = rows_capacity == 0 ? 1024 : rows_capacity * 2;
+                }
+                table.row_items = realloc(table.row_items, sizeof(*table.row_items) * rows_capacity);
+            }
+            memcpy(table.row_items + table.rows, batch->rows, sizeof(*batch->rows) * batch->rows_count);
+            table.rows += batch->rows_count;
+            for (size_t i = 0; i < batch->rows_count; ++i) {
+                if (table.cols < batch->rows[i].count) {
+                    table.cols = batch->rows[i].count;
+                }
+            }
+
+            batches = realloc(batches, sizeof(*batches) * (batches_count + 1));
+            batches[batches_count++] = batch;
+        }
+
+        for (; next_row < table.rows; ++next_row) {
+            if (!eof && !table_row_is_ready(&table, &eb, next_row)) {
+                break;
+            }
+
+            for (size_t col = 0; col < table.row_items[next_row].count; ++col) {
+                table_eval_cell(&table, &eb, next_row, col);
+            }
+        }
+
+        while (batches_written < batches_count &&
+               batch_end + batches[batches_written]->rows_count <= next_row) {
+            batch_end += batches[batches_written]->rows_count;
+            ring_push(&p->evaluated, batches[batches_written++]);
+        }
+        TRACE_END("eval batch");
+
+        if (eof) {
+            break;
+        }
+    }
+
+    ring_push(&p->evaluated, NULL);
+
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    stats.bytes_read = p->bytes_read;
+    stats.exprs = eb.count;
+    stats_count_cells(&table);
+
+    for (size_t i = 0; i < batches_count; ++i) {
+        free(batches[i]->memory);
+        free(batches[i]->cells);
+        free(batches[i]->rows);
+        free(batches[i]);
+    }
+    free(batches);
+    free(table.row_items);
+    free(eb.items);
+    ring_destroy(&p->blocks);
+    ring_destroy(&p->batches);
+    ring_destroy(&p->evaluated);
+    free(p);
+}
+
+size_t peak_rss_bytes(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (size_t) usage.ru_maxrss;
+#else
+    return (size_t) usage.ru_maxrss * 1024;
+#endif
+}
+
+void stats_report_text(FILE *stream)
+{
+    fprintf(stream, "Phases:\n");
+    double total = 0.0;
+    for (Phase phase = 0; phase < COUNT_PHASES; ++phase) {
+        if (stats.phase_ran[phase]) {
+            fprintf(stream, "  %-10s %12.6fs\n", phase_as_cstr(phase), stats.phase_secs[phase]);
+            total += stats.phase_secs[phase];
+        }
+    }
+    fprintf(stream, "  %-10s %12.6fs\n", "total", total);
+
+    fprintf(stream, "Counters:\n");
+    fprintf(stream, "  %-22s %zu\n", "bytes read", stats.bytes_read);
+    fprintf(stream, "  %-22s %zu x %zu\n", "table size", stats.rows, stats.cols);
+    fprintf(stream, "  %-22s %zu (%s)\n", "stored cells", stats.stored_cells, stats.storage ? stats.storage : "rows");
+    fprintf(stream, "  %-22s %zu (%zu per cell)\n", "cell bytes", stats.stored_cells * sizeof(Cell), sizeof(Cell));
+    for (size_t kind = 0; kind < CELL_KINDS_COUNT; ++kind) {
+        fprintf(stream, "  %-22s %zu\n", cell_kind_as_cstr((Cell_Kind) kind), stats.cells[kind]);
+    }
+    fprintf(stream, "  %-22s %zu\n", "exprs allocated", stats.exprs);
+    fprintf(stream, "  %-22s %zu of %zu (%.1f%%)\n", "interned formula hits", stats.intern_hits, stats.intern_lookups,
+            stats.intern_lookups > 0 ? 100.0 * (double) stats.intern_hits / (double) stats.intern_lookups : 0.0);
+    fprintf(stream, "  %-22s %zu\n", "expr buffer reallocs", (size_t) atomic_load(&expr_buffer_reallocs));
+    fprintf(stream, "  %-22s %zu\n", "max eval depth", stats.max_eval_depth);
+    fprintf(stream, "  %-22s %zu\n", "vectorized cells", stats.vectorized_cells);
+    fprintf(stream, "  %-22s %zu\n", "cached rows", stats.cached_rows);
+    fprintf(stream, "  %-22s %zu (%zu distinct, %zu bytes)\n", "pooled texts", stats.pooled_texts,
+            stats.distinct_texts, stats.text_pool_bytes);
+    fprintf(stream, "  %-22s %zu\n", "memory trims", (size_t) atomic_load(&paged_trims));
+    fprintf(stream, "  %-22s %zu\n", "peak rss bytes", peak_rss_bytes());
+
+    if (perf_enabled) {
+        fprintf(stream, "Hardware counters:\n");
+        fprintf(stream, "  %-10s", "");
+        for (Perf_Counter i = 0; i < COUNT_PERF_COUNTERS; ++i) {
+            fprintf(stream, " %14s", perf_counter_as_cstr(i));
+        }
+        fprintf(stream, " %8s\n", "ipc");
+
+        uint64_t total[COUNT_PERF_COUNTERS] = {0};
+        for (Phase phase = 0; phase <= COUNT_PHASES; ++phase) {
+            uint64_t *counters = total;
+            double scale = 1.0;
+            const char *name = "per cell";
+            if (phase < COUNT_PHASES) {
+                if (!stats.phase_ran[phase]) continue;
+                counters = stats.phase_counters[phase];
+                name = phase_as_cstr(phase);
+                for (size_t i = 0; i < COUNT_PERF_COUNTERS; ++i) {
+                    total[i] += counters[i];
+                }
+            } else {
+                size_t cells = 0;
+                for (size_t kind = 0; kind < CELL_KINDS_COUNT; ++kind) {
+                    cells += stats.cells[kind];
+                }
+                scale = cells > 0 ? 1.0 / (double) cells : 0.0;
+            }
+
+            fprintf(stream, "  %-10s", name);
+            for (Perf_Counter i = 0; i < COUNT_PERF_COUNTERS; ++i) {
+                if (perf_available(i)) {
+                    fprintf(stream, " %14.*f", scale < 1.0 ? 2 : 0, (double) counters[i] * scale);
+                } else {
+                    fprintf(stream, " %14s", "n/a");
+                }
+            }
+            if (perf_available(PERF_CYCLES) && perf_available(PERF_INSTRUCTIONS) && counters[PERF_CYCLES] > 0) {
+                fprintf(stream, " %8.2f\n", (double) counters[PERF_INSTRUCTIONS] / (double) counters[PERF_CYCLES]);
+            } else {
+                fprintf(stream, " %8s\n", "n/a");
+            }
+        }
+    }
+}
+
+void stats_report_json(FILE *stream)
+{
+    fprintf(stream, "{\"phases\":{");
+    bool first = true;
+    for (Phase phase = 0; phase < COUNT_PHASES; ++phase) {
+        if (stats.phase_ran[phase]) {
+            fprintf(stream, "%s\"%s\":%.9f", first ? "" : ",", phase_as_cstr(phase), stats.phase_secs[phase]);
+            first = false;
+        }
+    }
+    fprintf(stream, "},");
+    fprintf(stream, "\"bytes_read\":%zu,", stats.bytes_read);
+    fprintf(stream, "\"rows\":%zu,", stats.rows);
+    fprintf(stream, "\"cols\":%zu,", stats.cols);
+    fprintf(stream, "\"storage\":\"%s\",", stats.storage ? stats.storage : "rows");
+    fprintf(stream, "\"stored_cells\":%zu,", stats.stored_cells);
+    fprintf(stream, "\"cell_bytes\":%zu,", stats.stored_cells * sizeof(Cell));
+    fprintf(stream, "\"cells\":{");
+    for (size_t kind = 0; kind < CELL_KINDS_COUNT; ++kind) {
+        fprintf(stream, "%s\"%s\":%zu", kind > 0 ? "," : "", cell_kind_as_cstr((Cell_Kind) kind), stats.cells[kind]);
+    }
+    fprintf(stream, "},");
+    fprintf(stream, "\"exprs\":%zu,", stats.exprs);
+    fprintf(stream, "\"intern_lookups\":%zu,", stats.intern_lookups);
+    fprintf(stream, "\"intern_hits\":%zu,", stats.intern_hits);
+    fprintf(stream, "\"expr_buffer_reallocs\":%zu,", (size_t) atomic_load(&expr_buffer_reallocs));
+    fprintf(stream, "\"max_eval_depth\":%zu,", stats.max_eval_depth);
+    fprintf(stream, "\"vectorized_cells\":%zu,", stats.vectorized_cells);
+    fprintf(stream, "\"cached_rows\":%zu,", stats.cached_rows);
+    fprintf(stream, "\"pooled_texts\":%zu,", stats.pooled_texts);
+    fprintf(stream, "\"distinct_texts\":%zu,", stats.distinct_texts);
+    fprintf(stream, "\"text_pool_bytes\":%zu,", stats.text_pool_bytes);
+    fprintf(stream, "\"memory_trims\":%zu,", (size_t) atomic_load(&paged_trims));
+    fprintf(stream, "\"peak_rss_bytes\":%zu", peak_rss_bytes());
+
+    if (perf_enabled) {
+        fprintf(stream, ",\"perf\":{");
+        bool first = true;
+        for (Phase phase = 0; phase < COUNT_PHASES; ++phase) {
+            if (!stats.phase_ran[phase]) continue;
+            fprintf(stream, "%s\"%s\":{", first ? "" : ",", phase_as_cstr(phase));
+            first = false;
+            for (Perf_Counter i = 0; i < COUNT_PERF_COUNTERS; ++i) {
+                fprintf(stream, "%s\"%s\":", i > 0 ? "," : "", perf_counter_as_cstr(i));
+                if (perf_available(i)) {
+                    fprintf(stream, "%" PRIu64, stats.phase_counters[phase][i]);
+                } else {
+                    fprintf(stream, "null");
+                }
+            }
+            fprintf(stream, "}");
+        }
+        fprintf(stream, "}");
+    }
+
+    fprintf(stream, "}\n");
+}
+
+void sb_append_expr(String_Builder *sb, Table *table, Expr_Buffer *eb, Expr_Index expr_index, size_t row, size_t col)
+{
+    Expr *expr = expr_buffer_at(eb, expr_index);
+
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER: {
+        char buffer[64];
+        int n = snprintf(buffer, sizeof(buffer), "%g", expr->as.number);
+        sb_append(sb, buffer, (size_t) n);
+    }
+    break;
+
+    case EXPR_KIND_CELL:
+    case EXPR_KIND_REL_CELL:
+    case EXPR_KIND_CELL_INDEX: {
+        size_t ref_row, ref_col;
+        expr_cell_position(table, expr, row, col, &ref_row, &ref_col);
+        sb_append_cell_name(sb, ref_row, ref_col);
+    }
+    break;
+
+    case EXPR_KIND_PLUS:
+        sb_append_expr(sb, table, eb, expr->as.plus.lhs, row, col);
+        sb_append(sb, "+", 1);
+        sb_append_expr(sb, table, eb, expr->as.plus.rhs, row, col);
+        break;
+    }
+}
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    size_t *items;
+} Cell_Refs;
+
+// Collects the distinct cells that the expression refers to directly as
+// indices into table->cells
+void collect_refs(Table *table, Expr_Buffer *eb, Expr_Index expr_index, size_t row, size_t col, Cell_Refs *refs)
+{
+    Expr *expr = expr_buffer_at(eb, expr_index);
+
+    switch (expr->kind) {
+    case EXPR_KIND_NUMBER:
+        break;
+
+    case EXPR_KIND_CELL:
+    case EXPR_KIND_REL_CELL:
+    case EXPR_KIND_CELL_INDEX: {
+        size_t ref_row, ref_col;
+        expr_cell_position(table, expr, row, col, &ref_row, &ref_col);
+        size_t index = table_cell_index(table, ref_row, ref_col);
+        for (size_t i = 0; i < refs->count; ++i) {
+            if (refs->items[i] == index) {
+                return;
+            }
+        }
+        if (refs->count >= refs->capacity) {
+            refs->capacity = refs->capacity == 0 ? 16 : refs->capacity * 2;
+            refs->items = realloc(refs->items, sizeof(*refs->items) * refs->capacity);
+        }
+        refs->items[refs->count++] = index;
+    }
+    break;
+
+    case EXPR_KIND_PLUS:
+        collect_refs(table, eb, expr->as.plus.lhs, row, col, refs);
+        collect_refs(table, eb, expr->as.plus.rhs, row, col, refs);
+        break;
+    }
+}
+
+int compare_profiles(const void *a, const void *b)
+{
+    uint64_t x = profile[*(const size_t *) a].inclusive_ticks;
+    uint64_t y = profile[*(const size_t *) b].inclusive_ticks;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void profile_report(FILE *stream, Table *table, Expr_Buffer *eb, size_t top)
+{
+    size_t cells_count = table_cells_count(table);
+    size_t *formulas = malloc(sizeof(*formulas) * (cells_count > 0 ? cells_count : 1));
+    size_t formulas_count = 0;
+
+    Cell_Refs refs = {0};
+    for (size_t i = 0; i < cells_count; ++i) {
+        Cell *cell = &table->cells[i];
+        // Only the selected cells and their dependencies are evaluated with --cells
+        if (cell->kind != CELL_KIND_EXPR || cell->status != EVALUATED) {
+            continue;
+        }
+
+        formulas[formulas_count++] = i;
+        refs.count = 0;
+        size_t row, col;
+        table_cell_position(table, i, &row, &col);
+        collect_refs(table, eb, cell->index, row, col, &refs);
+        profile[i].fan_out = refs.count;
+        for (size_t j = 0; j < refs.count; ++j) {
+            profile[refs.items[j]].fan_in += 1;
+        }
+    }
+    free(refs.items);
+
+    qsort(formulas, formulas_count, sizeof(*formulas), compare_profiles);
+    if (top > formulas_count) {
+        top = formulas_count;
+    }
+
+    fprintf(stream, "Top %zu of %zu formulas by inclusive %s:\n", top, formulas_count, PROFILE_TICKS_UNIT);
+    fprintf(stream, "  %-8s %14s %14s %10s %10s %7s %7s  %s\n",
+            "CELL", "INCL " PROFILE_TICKS_UNIT, "EXCL " PROFILE_TICKS_UNIT,
+            "INCL NODES", "EXCL NODES", "FAN-IN", "FAN-OUT", "FORMULA");
+
+    String_Builder sb = {0};
+    for (size_t i = 0; i < top; ++i) {
+        size_t index = formulas[i];
+        Profile *entry = &profile[index];
+
+        sb.count = 0;
+        size_t row, col;
+        table_cell_position(table, index, &row, &col);
+        sb_append_cell_name(&sb, row, col);
+        size_t name_count = sb.count;
+        sb_append(&sb, "=", 1);
+        sb_append_expr(&sb, table, eb, table->cells[index].index, row, col);
+
+        fprintf(stream, "  %-8.*s %14" PRIu64 " %14" PRIu64 " %10zu %10zu %7zu %7zu  %.*s\n",
+                (int) name_count, sb.items,
+                entry->inclusive_ticks, entry->exclusive_ticks,
+                entry->inclusive_nodes, entry->exclusive_nodes,
+                entry->fan_in, entry->fan_out,
+                (int) (sb.count - name_count), sb.items + name_count);
+    }
+
+    free(sb.items);
+    free(formulas);
+}
+
+typedef enum {
+    STATS_NONE = 0,
+    STATS_TEXT,
+    STATS_JSON,
+} Stats_Format;
+
+typedef enum {
+    OUTPUT_FORMAT_TEXT = 0,
+    OUTPUT_FORMAT_ARROW,
+} Output_Format;
+
+// Line hashes
+//
+// The hash and the byte offset of every line of the input, used to find
+// out which rows changed since an earlier look at the input (see --watch
+// and --cache).
+
+typedef struct {
+    size_t offset;
+    uint64_t hash;
+} Line_Hash;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Line_Hash *items;
+} Line_Hashes;
+
+void hash_lines(String_View content, Line_Hashes *lines)
+{
+    lines->count = 0;
+    const char *begin = content.data;
+    while (content.count > 0) {
+        if (lines->count >= lines->capacity) {
+            lines->capacity = lines->capacity == 0 ? 256 : lines->capacity * 2;
+            lines->items = realloc(lines->items, sizeof(*lines->items) * lines->capacity);
+            assert(lines->items != NULL && "Buy more RAM lol");
+        }
+
+        Line_Hash *line = &lines->items[lines->count++];
+        line->offset = (size_t) (content.data - begin);
+        line->hash = intern_hash(csv_chop_by_delim(&content, '\n'));
+    }
+}
+
+String_View line_at(const char *content, size_t content_size, const Line_Hashes *lines, size_t row)
+{
+    size_t end = row + 1 < lines->count ? lines->items[row + 1].offset : content_size;
+    String_View line = {
+        .count = end - lines->items[row].offset,
+        .data = content + lines->items[row].offset,
+    };
+    return csv_chop_by_delim(&line, '\n');
+}
+
+size_t line_cells_count(String_View line)
+{
+    size_t cells = 0;
+    for (; line.count > 0; ++cells) {
+        csv_chop_by_delim(&line, '|');
+    }
+    return cells;
+}
+
+// Watch mode (--watch)
+//
+// The table is evaluated once and then kept in memory while the input is
+// watched with inotify. On every change the lines of the new input are
+// hashed and compared with the lines of the old one. Only the rows whose
+// hash changed are parsed again, the copies of the changed cells are
+// resolved again and only the formulas that depend on them, directly or
+// through other formulas, are evaluated again before the whole table is
+// written. A change that adds or removes rows or cells, or that leaves
+// too many dead expressions in the Expr_Buffer, loads the table from
+// scratch instead.
+
+#define WATCH_NONE SIZE_MAX
+
+// A formula that refers to a cell, linked into the list of the cell
+typedef struct {
+    size_t cell;
+    size_t next;
+} Watch_Edge;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Watch_Edge *items;
+} Watch_Edges;
+
+typedef struct {
+    Layout layout;
+    Output_Format output_format;
+    size_t jobs;
+    FILE *output;
+
+    char *content;
+    size_t content_size;
+    Line_Hashes lines;
+
+    Table table;
+    Expr_Buffer eb;
+    Tmp_Cstr tc;
+    size_t cells_count;
+    // The number of expressions right after the table was loaded
+    size_t loaded_exprs;
+
+    // DIR + 1 of the cells that are copies of their neighbors in the
+    // input, 0 for the rest. The copies are resolved into formulas, so
+    // this is the only place that remembers them.
+    unsigned char *clone_dirs;
+    // The first edge of the formulas that refer to every cell, or
+    // WATCH_NONE. The edges of the formulas that have been changed are
+    // never removed, they only make the update evaluate a few more
+    // formulas than needed.
+    size_t *dependents;
+    Watch_Edges edges;
+    // The position of every cell in the list of the cells to update, or
+    // WATCH_NONE
+    size_t *marks;
+
+    // The scratch arrays of watch_update(). They live here rather than on
+    // its stack, since an error in the input leaves it with a longjmp.
+    Index_Array changed_rows;
+    Index_Array changed_cells;
+    Check_Refs refs;
+} Watch;
+
+void watch_add_dependents(Watch *w, size_t cell, Check_Refs *refs)
+{
+    size_t row, col;
+    table_cell_position(&w->table, cell, &row, &col);
+    refs->count = 0;
+    append_expr_refs(&w->table, &w->eb, w->table.cells[cell].index, row, col, refs);
+
+    for (size_t i = 0; i < refs->count; ++i) {
+        if (w->edges.count >= w->edges.capacity) {
+            w->edges.capacity = w->edges.capacity == 0 ? 256 : w->edges.capacity * 2;
+            w->edges.items = realloc(w->edges.items, sizeof(*w->edges.items) * w->edges.capacity);
+            assert(w->edges.items != NULL && "Buy more RAM lol");
+        }
+
+        size_t ref = refs->items[i].cell;
+        w->edges.items[w->edges.count] = (Watch_Edge) {
+            .cell = cell,
+            .next = w->dependents[ref],
+        };
+        w->dependents[ref] = w->edges.count++;
+    }
+}
+
+void watch_free_table(Watch *w)
+{
+    free(w->content);
+    free(w->table.cells);
+    free(w->table.row_offsets);
+    free(w->clone_dirs);
+    free(w->dependents);
+    free(w->marks);
+    w->content = NULL;
+    w->clone_dirs = NULL;
+    w->dependents = NULL;
+    w->marks = NULL;
+    w->eb.count = 0;
+    w->edges.count = 0;
+    memset(&w->table, 0, sizeof(w->table));
+}
+
+// Takes the ownership of the content
+void watch_load(Watch *w, char *content, size_t content_size)
+{
+    watch_free_table(w);
+    w->content = content;
+    w->content_size = content_size;
+
+    String_View input = {
+        .count = content_size,
+        .data = content,
+    };
+    hash_lines(input, &w->lines);
+
+    Table *table = &w->table;
+    size_t cells_count = 0;
+    estimate_table_size(input, &table->rows, &table->cols, &cells_count);
+    table->layout = w->layout;
+    if (w->layout == LAYOUT_ROWS && table_should_be_ragged(table->rows, table->cols, cells_count)) {
+        table->row_offsets = malloc(sizeof(*table->row_offsets) * (table->rows + 1));
+        assert(table->row_offsets != NULL && "Buy more RAM lol");
+        // One more cell for the empty cell past the end of every row
+        cells_count += 1;
+    } else {
+        cells_count = table_cells_count(table);
+    }
+    w->cells_count = cells_count;
+    table->cells = calloc(cells_count > 0 ? cells_count : 1, sizeof(*table->cells));
+    assert(table->cells != NULL && "Buy more RAM lol");
+    parse_table_from_content(table, &w->eb, &w->tc, input, false, NULL, NULL);
+
+    w->clone_dirs = calloc(cells_count > 0 ? cells_count : 1, sizeof(*w->clone_dirs));
+    w->dependents = malloc(sizeof(*w->dependents) * (cells_count > 0 ? cells_count : 1));
+    w->marks = malloc(sizeof(*w->marks) * (cells_count > 0 ? cells_count : 1));
+    assert(w->clone_dirs != NULL && w->dependents != NULL && w->marks != NULL && "Buy more RAM lol");
+    for (size_t i = 0; i < cells_count; ++i) {
+        if (table->cells[i].kind == CELL_KIND_CLONE) {
+            w->clone_dirs[i] = (unsigned char) (table->cells[i].dir + 1);
+        }
+        w->dependents[i] = WATCH_NONE;
+        w->marks[i] = WATCH_NONE;
+    }
+
+    table_link_refs(table, &w->eb);
+    Index_Array order = table_check_types(table, &w->eb);
+    table_eval_ordered(table, &w->eb, &order);
+
+    Check_Refs refs = {0};
+    for (size_t i = 0; i < order.count; ++i) {
+        watch_add_dependents(w, order.items[i], &refs);
+    }
+    free(refs.items);
+    free(order.items);
+
+    w->loaded_exprs = w->eb.count;
+}
+
+void watch_mark(Watch *w, Index_Array *cells, size_t cell)
+{
+    if (w->marks[cell] == WATCH_NONE) {
+        w->marks[cell] = cells->count;
+        index_array_push(cells, cell);
+    }
+}
+
+// Evaluates the marked formulas in the order of their dependencies. The
+// formulas that are not marked keep their values.
+void watch_eval_marked(Watch *w, const Index_Array *cells)
+{
+    Table *table = &w->table;
+    size_t *pending = calloc(cells->count > 0 ? cells->count : 1, sizeof(*pending));
+    size_t *first = malloc(sizeof(*first) * (cells->count + 1));
+    assert(pending != NULL && first != NULL && "Buy more RAM lol");
+    Index_Array from = {0};
+    Index_Array to = {0};
+    Check_Refs refs = {0};
+    size_t errors = 0;
+    size_t formulas = 0;
+
+    for (size_t i = 0; i < cells->count; ++i) {
+        Cell *cell = &table->cells[cells->items[i]];
+        if (cell->kind != CELL_KIND_EXPR) {
+            continue;
+        }
+        formulas += 1;
+
+        size_t row, col;
+        table_cell_position(table, cells->items[i], &row, &col);
+        refs.count = 0;
+        append_expr_refs(table, &w->eb, cell->index, row, col, &refs);
+        for (size_t j = 0; j < refs.count; ++j) {
+            size_t ref = refs.items[j].cell;
+            Cell_Kind kind = table->cells[ref].kind;
+            if (kind == CELL_KIND_TEXT) {
+                report_ref_error(table, &w->eb, row, col, "text cells may not participate in math expressions:", refs.items[j].expr);
+                errors += 1;
+            } else if (kind == CELL_KIND_EXPR && w->marks[ref] != WATCH_NONE) {
+                index_array_push(&from, w->marks[ref]);
+                index_array_push(&to, i);
+                pending[i] += 1;
+            }
+        }
+    }
+
+    if (errors > 0) {
+        free(pending);
+        free(first);
+        free(from.items);
+        free(to.items);
+        free(refs.items);
+        fprintf(stderr, "ERROR: %zu error%s in the formulas\n", errors, errors == 1 ? "" : "s");
+        input_error();
+    }
+
+    // The formulas that refer to every marked cell, grouped by the cell
+    size_t *next = malloc(sizeof(*next) * (to.count > 0 ? to.count : 1));
+    assert(next != NULL && "Buy more RAM lol");
+    memset(first, 0, sizeof(*first) * (cells->count + 1));
+    for (size_t i = 0; i < from.count; ++i) {
+        first[from.items[i] + 1] += 1;
+    }
+    for (size_t i = 0; i < cells->count; ++i) {
+        first[i + 1] += first[i];
+    }
+    for (size_t i = 0; i < from.count; ++i) {
+        next[first[from.items[i]]++] = to.items[i];
+    }
+    for (size_t i = cells->count; i > 0; --i) {
+        first[i] = first[i - 1];
+    }
+    first[0] = 0;
+
+    Index_Array ready = {0};
+    for (size_t i = 0; i < cells->count; ++i) {
+        if (pending[i] == 0) {
+            index_array_push(&ready, i);
+        }
+    }
+
+    size_t evaluated = 0;
+    for (size_t k = 0; k < ready.count; ++k) {
+        size_t i = ready.items[k];
+        Cell *cell = &table->cells[cells->items[i]];
+        if (cell->kind == CELL_KIND_EXPR) {
+            size_t row, col;
+            table_cell_position(table, cells->items[i], &row, &col);
+            cell->value = table_eval_numeric(table, &w->eb, cell->index, row, col);
+            cell->status = EVALUATED;
+            evaluated += 1;
+        }
+
+        for (size_t j = first[i]; j < first[i + 1]; ++j) {
+            if (--pending[next[j]] == 0) {
+                index_array_push(&ready, next[j]);
+            }
+        }
+    }
+
+    free(pending);
+    free(first);
+    free(next);
+    free(from.items);
+    free(to.items);
+    free(refs.items);
+    free(ready.items);
+
+    if (evaluated < formulas) {
+        fprintf(stderr, "ERROR: circular dependency is detected!\n");
+        input_error();
+    }
+}
+
+// Returns false when the table has to be loaded from scratch instead
+bool watch_update(Watch *w, char *content, size_t content_size, Line_Hashes *lines, bool *changed)
+{
+    Table *table = &w->table;
+    *changed = false;
+    if (lines->count != table->rows || w->eb.count > 2 * w->loaded_exprs + 1024) {
+        return false;
+    }
+
+    Index_Array *rows = &w->changed_rows;
+    rows->count = 0;
+    for (size_t row = 0; row < table->rows; ++row) {
+        if (lines->items[row].hash == w->lines.items[row].hash) {
+            continue;
+        }
+
+        String_View old_line = line_at(w->content, w->content_size, &w->lines, row);
+        String_View new_line = line_at(content, content_size, lines, row);
+        if (line_cells_count(old_line) != line_cells_count(new_line)) {
+            return false;
+        }
+        index_array_push(rows, row);
+    }
+
+    if (rows->count == 0) {
+        free(content);
+        return true;
+    }
+    *changed = true;
+
+    // The text of the cells follows its line into the new content. The
+    // cells of the changed rows and their copies are parsed and resolved
+    // again below.
+    for (size_t i = 0; i < w->cells_count; ++i) {
+        Cell *cell = &table->cells[i];
+        if (cell->kind != CELL_KIND_TEXT || cell->text == NULL) {
+            continue;
+        }
+
+        // The line of the text, which is not necessarily the row of the
+        // cell since the text cells may be copies too
+        size_t offset = (size_t) (cell->text - w->content);
+        size_t lo = 0;
+        size_t hi = table->rows;
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (w->lines.items[mid].offset <= offset) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+
+        if (lines->items[lo].hash == w->lines.items[lo].hash) {
+            cell->text = content + (offset - w->lines.items[lo].offset + lines->items[lo].offset);
+        }
+    }
+
+    Index_Array *cells = &w->changed_cells;
+    cells->count = 0;
+    for (size_t i = 0; i < rows->count; ++i) {
+        size_t row = rows->items[i];
+        String_View old_line = line_at(w->content, w->content_size, &w->lines, row);
+        String_View line = line_at(content, content_size, lines, row);
+        for (size_t col = 0; line.count > 0; ++col) {
+            String_View old_value = sv_trim(csv_chop_by_delim(&old_line, '|'));
+            String_View cell_value = sv_trim(csv_chop_by_delim(&line, '|'));
+            Cell *cell = table_cell_at(table, row, col);
+
+            // Only the text cells of a changed line have to move to the
+            // new content
+            size_t index = (size_t) (cell - table->cells);
+            if (sv_eq(old_value, cell_value) && (w->clone_dirs[index] != 0 || cell->kind != CELL_KIND_TEXT)) {
+                continue;
+            }
+
+            memset(cell, 0, sizeof(*cell));
+            parse_cell(cell, &w->eb, &w->tc, cell_value);
+            w->clone_dirs[index] = cell->kind == CELL_KIND_CLONE ? (unsigned char) (cell->dir + 1) : 0;
+            watch_mark(w, cells, index);
+        }
+    }
+
+    free(w->content);
+    w->content = content;
+    w->content_size = content_size;
+    Line_Hashes swap = w->lines;
+    w->lines = *lines;
+    *lines = swap;
+
+    // The copies of the changed cells are copies again, and so on along
+    // the whole chain of the copies
+    static const Dir opposite[] = {
+        [DIR_LEFT] = DIR_RIGHT,
+        [DIR_RIGHT] = DIR_LEFT,
+        [DIR_UP] = DIR_DOWN,
+        [DIR_DOWN] = DIR_UP,
+    };
+    for (size_t i = 0; i < cells->count; ++i) {
+        size_t row, col;
+        table_cell_position(table, cells->items[i], &row, &col);
+        for (Dir dir = DIR_LEFT; dir <= DIR_DOWN; ++dir) {
+            size_t nrow, ncol;
+            if (!table_neighbor(table, row, col, dir, &nrow, &ncol)) {
+                continue;
+            }
+
+            Cell *neighbor = table_cell_at(table, nrow, ncol);
+            size_t index = (size_t) (neighbor - table->cells);
+            if (w->clone_dirs[index] == opposite[dir] + 1 && w->marks[index] == WATCH_NONE) {
+                neighbor->kind = CELL_KIND_CLONE;
+                neighbor->dir = opposite[dir];
+                neighbor->resolving = false;
+                watch_mark(w, cells, index);
+            }
+        }
+    }
+
+    size_t changed_cells = cells->count;
+    for (size_t i = 0; i < changed_cells; ++i) {
+        if (table->cells[cells->items[i]].kind == CELL_KIND_CLONE) {
+            size_t row, col;
+            table_cell_position(table, cells->items[i], &row, &col);
+            table_resolve_clone(table, &w->eb, row, col);
+        }
+    }
+
+    size_t errors = 0;
+    Check_Refs *refs = &w->refs;
+    for (size_t i = 0; i < changed_cells; ++i) {
+        if (table->cells[cells->items[i]].kind == CELL_KIND_EXPR) {
+            size_t row, col;
+            table_cell_position(table, cells->items[i], &row, &col);
+            errors += table_link_expr(table, &w->eb, table->cells[cells->items[i]].index, row, col);
+        }
+    }
+    if (errors > 0) {
+        fprintf(stderr, "ERROR: %zu reference%s outside of the table\n", errors, errors == 1 ? " is" : "s are");
+        input_error();
+    }
+
+    for (size_t i = 0; i < changed_cells; ++i) {
+        if (table->cells[cells->items[i]].kind == CELL_KIND_EXPR) {
+            watch_add_dependents(w, cells->items[i], refs);
+        }
+    }
+
+    // Everything that depends on the changed cells
+    for (size_t i = 0; i < cells->count; ++i) {
+        for (size_t e = w->dependents[cells->items[i]]; e != WATCH_NONE; e = w->edges.items[e].next) {
+            watch_mark(w, cells, w->edges.items[e].cell);
+        }
+    }
+
+    watch_eval_marked(w, cells);
+
+    for (size_t i = 0; i < cells->count; ++i) {
+        w->marks[cells->items[i]] = WATCH_NONE;
+    }
+    return true;
+}
+
+void watch_output(Watch *w)
+{
+    // A file is written from scratch every time, a pipe or a terminal
+    // gets the tables one after another
+    fflush(w->output);
+    if (w->output != stdout && ftruncate(fileno(w->output), 0) == 0) {
+        rewind(w->output);
+    }
+
+    switch (w->output_format) {
+    case OUTPUT_FORMAT_TEXT:
+        table_dump_text_parallel(w->output, &w->table, w->jobs);
+        break;
+
+    case OUTPUT_FORMAT_ARROW:
+        table_dump_arrow(w->output, &w->table);
+        break;
+    }
+    fflush(w->output);
+}
+
+// Loads the table from the content, or updates it when `lines` are
+// given. Returns false when the content has errors, which have been
+// reported already. The table is left in an unknown state then.
+bool watch_try(Watch *w, char *content, size_t content_size, Line_Hashes *lines, bool *changed)
+{
+    jmp_buf recovery;
+    if (setjmp(recovery) != 0) {
+        input_error_recovery = NULL;
+        return false;
+    }
+    input_error_recovery = &recovery;
+
+    *changed = false;
+    if (lines == NULL || !watch_update(w, content, content_size, lines, changed)) {
+        watch_load(w, content, content_size);
+        *changed = true;
+    }
+
+    input_error_recovery = NULL;
+    return true;
+}
+
+void watch_run(const char *input_file_path, FILE *output, Output_Format output_format, size_t jobs, Layout layout)
+{
+#ifdef MINICEL_INOTIFY
+    Watch w = {0};
+    w.layout = layout;
+    w.output_format = output_format;
+    w.jobs = jobs;
+    w.output = output;
+
+    // Editors often replace the file with a new one, so the directory is
+    // watched rather than the file
+    const char *slash = strrchr(input_file_path, '/');
+    const char *file_name = slash ? slash + 1 : input_file_path;
+    String_Builder dir = {0};
+    if (slash) {
+        sb_append(&dir, input_file_path, (size_t) (slash - input_file_path) + 1);
+    } else {
+        sb_append(&dir, ".", 1);
+    }
+    sb_append(&dir, "", 1);
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir.items, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "ERROR: could not watch %s: %s\n", dir.items, strerror(errno));
+        exit(1);
+    }
+    free(dir.items);
+
+    size_t content_size = 0;
+    char *content = slurp_file(input_file_path, &content_size);
+    if (content == NULL) {
+        fprintf(stderr, "ERROR: could not read file %s: %s\n",
+                input_file_path, strerror(errno));
+        exit(1);
+    }
+    // A copy of the last content without errors, which is loaded again
+    // when a change breaks the table
+    char *good_content = NULL;
+    size_t good_content_size = 0;
+    bool changed = false;
+    if (watch_try(&w, content, content_size, NULL, &changed)) {
+        good_content = malloc(content_size > 0 ? content_size : 1);
+        assert(good_content != NULL && "Buy more RAM lol");
+        memcpy(good_content, content, content_size);
+        good_content_size = content_size;
+        watch_output(&w);
+    } else {
+        fprintf(stderr, "WARNING: %s has errors, waiting for the next change\n", input_file_path);
+        watch_free_table(&w);
+    }
+
+    Line_Hashes lines = {0};
+    _Alignas(struct inotify_event) char events[4096];
+    for (;;) {
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: could not watch %s: %s\n", input_file_path, strerror(errno));
+            exit(1);
+        }
+
+        bool touched = false;
+        for (ssize_t i = 0; i < n;) {
+            const struct inotify_event *event = (const struct inotify_event *) (events + i);
+            if (event->len > 0 && strcmp(event->name, file_name) == 0) {
+                touched = true;
+            }
+            i += (ssize_t) (sizeof(*event) + event->len);
+        }
+        if (!touched) {
+            continue;
+        }
+
+        content = slurp_file(input_file_path, &content_size);
+        if (content == NULL) {
+            // Probably in the middle of being replaced, the next event
+            // brings the new file
+            fprintf(stderr, "WARNING: could not read file %s: %s\n",
+                    input_file_path, strerror(errno));
+            continue;
+        }
+
+        String_View input = {
+            .count = content_size,
+            .data = content,
+        };
+        hash_lines(input, &lines);
+
+        if (!watch_try(&w, content, content_size, &lines, &changed)) {
+            fprintf(stderr, "WARNING: %s has errors, the output keeps the last good table\n", input_file_path);
+            // The content is not owned by the table yet if the error was
+            // found before the table moved to it
+            if (w.content != content) {
+                free(content);
+            }
+            watch_free_table(&w);
+            if (good_content != NULL) {
+                char *copy = malloc(good_content_size > 0 ? good_content_size : 1);
+                assert(copy != NULL && "Buy more RAM lol");
+                memcpy(copy, good_content, good_content_size);
+                bool reloaded = watch_try(&w, copy, good_content_size, NULL, &changed);
+                assert(reloaded && "the last good content loads again");
+                (void) reloaded;
+            }
+            continue;
+        }
+
+        if (changed) {
+            good_content = realloc(good_content, content_size > 0 ? content_size : 1);
+            assert(good_content != NULL && "Buy more RAM lol");
+            memcpy(good_content, w.content, content_size);
+            good_content_size = content_size;
+            watch_output(&w);
+        }
+    }
+#else
+    (void) input_file_path;
+    (void) output;
+    (void) output_format;
+    (void) jobs;
+    (void) layout;
+    fprintf(stderr, "ERROR: minicel was compiled without inotify\n");
+    exit(1);
+#endif
+}
+
+// Result cache (--cache)
+//
+// Every input gets an entry in the cache directory, named after the hash
+// of the absolute path of the input, with the hash of every row, the
+// evaluated value of every cell and the rows every row reads from. A
+// later run reuses the values of a row when the row and all the rows it
+// reads from, directly or through other rows, hash the same as before.
+// Such rows are neither parsed nor evaluated. The entries that were used
+// the longest time ago are removed once the directory grows past the
+// limit. The entries are in the native byte order.
+
+#define CACHE_MAGIC 0x3145484341434d00ULL
+#define CACHE_DEFAULT_LIMIT (256 * 1024 * 1024)
+
+typedef struct {
+    uint64_t magic;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t deps;
+    uint64_t cells;
+    // Followed by Cache_Row rows[rows + 1], uint64_t deps[deps],
+    // double values[cells] and uint8_t kinds[cells]
+} Cache_Header;
+
+typedef struct {
+    uint64_t hash;
+    // The cells of the row are values[cells_begin .. cells_begin of the
+    // next row], same for the rows it reads from in deps
+    uint64_t cells_begin;
+    uint64_t deps_begin;
+    // A row with copies of text cells from other rows cannot be restored
+    // from the values
+    uint64_t reusable;
+} Cache_Row;
+
+typedef struct {
+    String_Builder path;
+    char *data;
+    size_t size;
+    const Cache_Header *header;
+    const Cache_Row *rows;
+    const uint64_t *deps;
+    const double *values;
+    const uint8_t *kinds;
+
+    Line_Hashes lines;
+    // The rows that are restored from the entry
+    bool *cached;
+    // The directions of the copies in every row that is parsed, since
+    // they are gone once the copies are resolved
+    unsigned char *copies;
+} Cache;
+
+// Parses a size in bytes like 4096, 512K, 64M or 2G
+bool parse_size(const char *text, size_t *size)
+{
+    char *endptr = NULL;
+    unsigned long long n = strtoull(text, &endptr, 10);
+    if (endptr == text) {
+        return false;
+    }
+
+    size_t unit = 1;
+    if (*endptr == 'K') {
+        unit = 1024;
+        endptr += 1;
+    } else if (*endptr == 'M') {
+        unit = 1024 * 1024;
+        endptr += 1;
+    } else if (*endptr == 'G') {
+        unit = 1024 * 1024 * 1024;
+        endptr += 1;
+    }
+
+    if (*endptr != '\0' || n > SIZE_MAX / unit) {
+        return false;
+    }
+    *size = (size_t) n * unit;
+    return true;
+}
+
+void cache_open(Cache *cache, const char *cache_dir, const char *input_file_path, String_View content,
+                size_t rows, size_t cols)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    if (mkdir(cache_dir, 0777) < 0 && errno != EEXIST) {
+        fprintf(stderr, "WARNING: could not create cache directory %s: %s\n", cache_dir, strerror(errno));
+    }
+
+    char *real_path = realpath(input_file_path, NULL);
+    const char *key = real_path ? real_path : input_file_path;
+    char name[32];
+    snprintf(name, sizeof(name), "/%016" PRIx64 ".cache", intern_hash(sv_from_cstr(key)));
+    free(real_path);
+    sb_append(&cache->path, cache_dir, strlen(cache_dir));
+    sb_append(&cache->path, name, strlen(name) + 1);
+
+    hash_lines(content, &cache->lines);
+    cache->cached = calloc(rows > 0 ? rows : 1, sizeof(*cache->cached));
+    cache->copies = calloc(rows > 0 ? rows : 1, sizeof(*cache->copies));
+    assert(cache->cached != NULL && cache->copies != NULL && "Buy more RAM lol");
+
+    cache->data = map_file(cache->path.items, &cache->size);
+    if (cache->data == NULL) {
+        return;
+    }
+
+    const Cache_Header *header = (const Cache_Header *) cache->data;
+    bool valid = cache->size >= sizeof(*header) &&
+                 header->magic == CACHE_MAGIC &&
+                 cache->size == sizeof(*header) + (header->rows + 1) * sizeof(Cache_Row) +
+                                header->deps * sizeof(uint64_t) + header->cells * (sizeof(double) + sizeof(uint8_t));
+    if (!valid) {
+        unmap_file(cache->data, cache->size);
+        cache->data = NULL;
+        return;
+    }
+
+    cache->header = header;
+    cache->rows = (const Cache_Row *) (cache->data + sizeof(*header));
+    cache->deps = (const uint64_t *) (cache->rows + header->rows + 1);
+    cache->values = (const double *) (cache->deps + header->deps);
+    cache->kinds = (const uint8_t *) (cache->values + header->cells);
+
+    // The references outside of the table depend on the width of the
+    // whole table
+    if (header->cols != cols) {
+        return;
+    }
+
+    size_t matched = rows < header->rows ? rows : header->rows;
+    for (size_t row = 0; row < matched; ++row) {
+        const Cache_Row *r = &cache->rows[row];
+        cache->cached[row] = r->reusable && r->hash == cache->lines.items[row].hash;
+        for (uint64_t i = r->deps_begin; i < r[1].deps_begin && cache->cached[row]; ++i) {
+            cache->cached[row] = cache->deps[i] < rows;
+        }
+    }
+
+    // A row is not reused if any row it reads from is not
+    size_t *first = calloc(matched + 1, sizeof(*first));
+    size_t *dependents = malloc(sizeof(*dependents) * (cache->rows[matched].deps_begin + 1));
+    assert(first != NULL && dependents != NULL && "Buy more RAM lol");
+    for (size_t row = 0; row < matched; ++row) {
+        for (uint64_t i = cache->rows[row].deps_begin; i < cache->rows[row + 1].deps_begin; ++i) {
+            if (cache->deps[i] < matched) {
+                first[cache->deps[i] + 1] += 1;
+            }
+        }
+    }
+    for (size_t row = 0; row < matched; ++row) {
+        first[row + 1] += first[row];
+    }
+    for (size_t row = 0; row < matched; ++row) {
+        for (uint64_t i = cache->rows[row].deps_begin; i < cache->rows[row + 1].deps_begin; ++i) {
+            if (cache->deps[i] < matched) {
+                dependents[first[cache->deps[i]]++] = row;
+            }
+        }
+    }
+    for (size_t row = matched; row > 0; --row) {
+        first[row] = first[row - 1];
+    }
+    first[0] = 0;
+
+    Index_Array stale = {0};
+    for (size_t row = 0; row < rows; ++row) {
+        if (!cache->cached[row]) {
+            index_array_push(&stale, row);
+        }
+    }
+    for (size_t i = 0; i < stale.count; ++i) {
+        size_t row = stale.items[i];
+        if (row >= matched) {
+            continue;
+        }
+        for (size_t j = first[row]; j < first[row + 1]; ++j) {
+            if (cache->cached[dependents[j]]) {
+                cache->cached[dependents[j]] = false;
+                index_array_push(&stale, dependents[j]);
+            }
+        }
+    }
+
+    free(stale.items);
+    free(first);
+    free(dependents);
+}
+
+// Turns the cells of the cached rows into their values and remembers the
+// copies of the other rows
+void cache_fill(Cache *cache, Table *table, Expr_Buffer *eb)
+{
+    // A copy needs the formula rather than the value of the copied cell,
+    // so the cells of the cached rows that are copied by the parsed rows
+    // are parsed too, along the whole chain of the copies
+    size_t cells_count = table_cells_count(table);
+    for (size_t i = 0; i < cells_count; ++i) {
+        if (table->cells[i].kind != CELL_KIND_CLONE) {
+            continue;
+        }
+
+        size_t row, col;
+        table_cell_position(table, i, &row, &col);
+        cache->copies[row] |= (unsigned char) (1 << table->cells[i].dir);
+
+        Cell *cell = &table->cells[i];
+        while (cell->kind == CELL_KIND_CLONE && table_neighbor(table, row, col, cell->dir, &row, &col)) {
+            cell = table_cell_at(table, row, col);
+            if (cell->kind != CELL_KIND_RAW) {
+                break;
+            }
+            table_load_raw_cell(eb, cell);
+        }
+    }
+
+    for (size_t row = 0; row < table->rows; ++row) {
+        if (!cache->cached[row]) {
+            continue;
+        }
+        stats.cached_rows += 1;
+
+        const Cache_Row *r = &cache->rows[row];
+        for (uint64_t i = r->cells_begin; i < r[1].cells_begin; ++i) {
+            Cell *cell = table_cell_at(table, row, (size_t) (i - r->cells_begin));
+            if (cell->kind != CELL_KIND_RAW) {
+                continue;
+            }
+
+            if (cache->kinds[i] == CELL_KIND_NUMBER) {
+                cell->kind = CELL_KIND_NUMBER;
+                cell->number = cache->values[i];
+            } else {
+                // The text stays where it is
+                cell->kind = CELL_KIND_TEXT;
+            }
+        }
+    }
+}
+
+int compare_sizes(const void *a, const void *b)
+{
+    size_t x = *(const size_t *) a;
+    size_t y = *(const size_t *) b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    char *name;
+    off_t size;
+    struct timespec mtime;
+} Cache_File;
+
+int compare_cache_files_by_mtime(const void *a, const void *b)
+{
+    const struct timespec *x = &((const Cache_File *) a)->mtime;
+    const struct timespec *y = &((const Cache_File *) b)->mtime;
+    if (x->tv_sec != y->tv_sec) {
+        return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+// Removes the least recently used entries until the directory fits into
+// the limit
+void cache_evict(const char *cache_dir, size_t limit)
+{
+    DIR *dir = opendir(cache_dir);
+    if (dir == NULL) {
+        return;
+    }
+
+    Cache_File *files = NULL;
+    size_t files_count = 0;
+    size_t files_capacity = 0;
+    size_t total = 0;
+    String_Builder path = {0};
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        size_t n = strlen(entry->d_name);
+        if (n < 6 || strcmp(entry->d_name + n - 6, ".cache") != 0) {
+            continue;
+        }
+
+        path.count = 0;
+        sb_append(&path, cache_dir, strlen(cache_dir));
+        sb_append(&path, "/", 1);
+        sb_append(&path, entry->d_name, n + 1);
+        struct stat st;
+        if (stat(path.items, &st) < 0) {
+            continue;
+        }
+
+        if (files_count >= files_capacity) {
+            files_capacity = files_capacity == 0 ? 64 : files_capacity * 2;
+            files = realloc(files, sizeof(*files) * files_capacity);
+            assert(files != NULL && "Buy more RAM lol");
+        }
+        files[files_count++] = (Cache_File) {
+            .name = strdup(path.items),
+            .size = st.st_size,
+            .mtime = st.st_mtim,
+        };
+        total += (size_t) st.st_size;
+    }
+    closedir(dir);
+
+    qsort(files, files_count, sizeof(*files), compare_cache_files_by_mtime);
+    for (size_t i = 0; i < files_count; ++i) {
+        if (total > limit && unlink(files[i].name) == 0) {
+            total -= (size_t) files[i].size;
+        }
+        free(files[i].name);
+    }
+    free(files);
+    free(path.items);
+}
+
+// Writes the values of the evaluated table into the entry of the input
+void cache_save(Cache *cache, Table *table, Expr_Buffer *eb, const char *content, size_t content_size,
+                const char *cache_dir, size_t limit)
+{
+    bool unchanged = cache->header != NULL && cache->header->rows == table->rows;
+    for (size_t row = 0; row < table->rows && unchanged; ++row) {
+        unchanged = cache->cached[row];
+    }
+    if (unchanged) {
+        // Only the time of the last use for the eviction
+        utimensat(AT_FDCWD, cache->path.items, NULL, 0);
+        cache_evict(cache_dir, limit);
+        return;
+    }
+
+    Cache_Row *rows = malloc(sizeof(*rows) * (table->rows + 1));
+    assert(rows != NULL && "Buy more RAM lol");
+    Index_Array deps = {0};
+    String_Builder values = {0};
+    String_Builder kinds = {0};
+    Check_Refs refs = {0};
+    size_t cells = 0;
+
+    for (size_t row = 0; row < table->rows; ++row) {
+        String_View line = line_at(content, content_size, &cache->lines, row);
+        size_t cols = line_cells_count(line);
+        rows[row] = (Cache_Row) {
+            .hash = cache->lines.items[row].hash,
+            .cells_begin = cells,
+            .deps_begin = deps.count,
+            .reusable = true,
+        };
+
+        if (cache->cached[row]) {
+            const Cache_Row *r = &cache->rows[row];
+            for (uint64_t i = r->deps_begin; i < r[1].deps_begin; ++i) {
+                index_array_push(&deps, cache->deps[i]);
+            }
+        } else {
+            size_t begin = deps.count;
+            if ((cache->copies[row] & (1 << DIR_UP)) && row > 0) {
+                index_array_push(&deps, row - 1);
+            }
+            if ((cache->copies[row] & (1 << DIR_DOWN)) && row + 1 < table->rows) {
+                index_array_push(&deps, row + 1);
+            }
+            for (size_t col = 0; col < cols; ++col) {
+                Cell *cell = table_cell_at(table, row, col);
+                if (cell->kind != CELL_KIND_EXPR) {
+                    continue;
+                }
+
+                refs.count = 0;
+                append_expr_refs(table, eb, cell->index, row, col, &refs);
+                for (size_t i = 0; i < refs.count; ++i) {
+                    size_t ref_row, ref_col;
+                    table_cell_position(table, refs.items[i].cell, &ref_row, &ref_col);
+                    if (ref_row != row) {
+                        index_array_push(&deps, ref_row);
+                    }
+                }
+            }
+
+            // Every row is stored once
+            qsort(deps.items + begin, deps.count - begin, sizeof(*deps.items), compare_sizes);
+            size_t unique = begin;
+            for (size_t i = begin; i < deps.count; ++i) {
+                if (unique == begin || deps.items[unique - 1] != deps.items[i]) {
+                    deps.items[unique++] = deps.items[i];
+                }
+            }
+            deps.count = unique;
+        }
+
+        for (size_t col = 0; col < cols; ++col) {
+            Cell *cell = table_cell_at(table, row, col);
+            double value = 0;
+            uint8_t kind = CELL_KIND_NUMBER;
+            switch (cell->kind) {
+            case CELL_KIND_NUMBER:
+                value = cell->number;
+                break;
+
+            case CELL_KIND_EXPR:
+                value = cell->value;
+                break;
+
+            case CELL_KIND_TEXT:
+                kind = CELL_KIND_TEXT;
+                if (cell->text < line.data || cell->text > line.data + line.count) {
+                    rows[row].reusable = false;
+                }
+                break;
+
+            case CELL_KIND_CLONE:
+            case CELL_KIND_RAW:
+                assert(0 && "the table is evaluated before it is cached");
+                exit(1);
+            }
+            sb_append(&values, &value, sizeof(value));
+            sb_append(&kinds, &kind, sizeof(kind));
+        }
+        cells += cols;
+    }
+    rows[table->rows] = (Cache_Row) {
+        .cells_begin = cells,
+        .deps_begin = deps.count,
+    };
+
+    Cache_Header header = {
+        .magic = CACHE_MAGIC,
+        .rows = table->rows,
+        .cols = table->cols,
+        .deps = deps.count,
+        .cells = cells,
+    };
+    static_assert(sizeof(*deps.items) == sizeof(uint64_t), "the rows are stored as uint64_t");
+
+    // The new entry replaces the old one at once, so a run that is killed
+    // halfway never leaves a broken entry behind
+    String_Builder tmp_path = {0};
+    char suffix[32];
+    int n = snprintf(suffix, sizeof(suffix), ".%d.tmp", (int) getpid());
+    sb_append(&tmp_path, cache->path.items, cache->path.count - 1);
+    sb_append(&tmp_path, suffix, (size_t) n + 1);
+
+    bool ok = false;
+    FILE *f = fopen(tmp_path.items, "wb");
+    if (f != NULL) {
+        ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(rows, sizeof(*rows), table->rows + 1, f) == table->rows + 1 &&
+             fwrite(deps.items, sizeof(*deps.items), deps.count, f) == deps.count &&
+             fwrite(values.items, 1, values.count, f) == values.count &&
+             fwrite(kinds.items, 1, kinds.count, f) == kinds.count;
+        ok = fclose(f) == 0 && ok;
+        ok = ok && rename(tmp_path.items, cache->path.items) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "WARNING: could not write cache entry %s: %s\n", cache->path.items, strerror(errno));
+        remove(tmp_path.items);
+    }
+
+    free(tmp_path.items);
+    free(rows);
+    free(deps.items);
+    free(values.items);
+    free(kinds.items);
+    free(refs.items);
+
+    cache_evict(cache_dir, limit);
+}
+
+void cache_close(Cache *cache)
+{
+    if (cache->data != NULL) {
+        unmap_file(cache->data, cache->size);
+    }
+    free(cache->path.items);
+    free(cache->lines.items);
+    free(cache->cached);
+    free(cache->copies);
+    memset(cache, 0, sizeof(*cache));
+}
+
+int main(int argc, char **argv)
+{
+    shift_args(&argc, &argv);
+
+    const char *input_file_path = NULL;
+    const char *output_file_path = NULL;
+    Output_Format output_format = OUTPUT_FORMAT_TEXT;
+    size_t jobs = 1;
+    bool pipeline = false;
+    Stats_Format stats_format = STATS_NONE;
+    const char *trace_file_path = NULL;
+    size_t profile_top = 0;
+    Layout layout = LAYOUT_ROWS;
+    Cell_Ranges selection = {0};
+    Columns projection = {0};
+    bool lazy = false;
+    bool use_index = false;
+    bool watch = false;
+    bool text_pool = false;
+    const char *cache_dir = NULL;
+    size_t cache_limit = CACHE_DEFAULT_LIMIT;
+
+    while (argc > 0) {
+        const char *arg = shift_args(&argc, &argv);
+
+        if (strcmp(arg, "-o") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no value is provided for %s\n", arg);
+                exit(1);
+            }
+            output_file_path = shift_args(&argc, &argv);
+        } else if (strcmp(arg, "-j") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no value is provided for %s\n", arg);
+                exit(1);
+            }
+            const char *value = shift_args(&argc, &argv);
+            char *endptr = NULL;
+            long n = strtol(value, &endptr, 10);
+            if (endptr == value || *endptr != '\0' || n < 1) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: %s expects a positive number of jobs, but got %s\n", arg, value);
+                exit(1);
+            }
+            jobs = (size_t) n;
+        } else if (strcmp(arg, "--stats") == 0 || strcmp(arg, "--stats=text") == 0) {
+            stats_format = STATS_TEXT;
+        } else if (strcmp(arg, "--stats=json") == 0) {
+            stats_format = STATS_JSON;
+        } else if (strcmp(arg, "--profile") == 0) {
+            profile_top = 10;
+        } else if (strncmp(arg, "--profile=", 10) == 0) {
+            char *endptr = NULL;
+            long n = strtol(arg + 10, &endptr, 10);
+            if (endptr == arg + 10 || *endptr != '\0' || n < 1) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: --profile expects a positive number of formulas, but got %s\n", arg + 10);
+                exit(1);
+            }
+            profile_top = (size_t) n;
+        } else if (strcmp(arg, "--trace") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no value is provided for %s\n", arg);
+                exit(1);
+            }
+            trace_file_path = shift_args(&argc, &argv);
+        } else if (strcmp(arg, "--perf") == 0) {
+            perf_enabled = true;
+        } else if (strcmp(arg, "--no-io-uring") == 0) {
+            use_io_uring = false;
+        } else if (strcmp(arg, "--no-vectorize") == 0) {
+            vectorize = false;
+        } else if (strcmp(arg, "--columns") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no value is provided for %s\n", arg);
+                exit(1);
+            }
+            const char *value = shift_args(&argc, &argv);
+            if (!parse_columns(value, &projection)) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: %s expects columns like A,C or ranges like C:E, but got %s\n", arg, value);
+                exit(1);
+            }
+        } else if (strcmp(arg, "--lazy") == 0) {
+            lazy = true;
+        } else if (strcmp(arg, "--index") == 0) {
+            use_index = true;
+        } else if (strcmp(arg, "--watch") == 0) {
+            watch = true;
+        } else if (strcmp(arg, "--text-pool") == 0) {
+            text_pool = true;
+        } else if (strcmp(arg, "--cache") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no value is provided for %s\n", arg);
+                exit(1);
+            }
+            cache_dir = shift_args(&argc, &argv);
+        } else if (strcmp(arg, "--max-memory") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no value is provided for %s\n", arg);
+                exit(1);
+            }
+            const char *value = shift_args(&argc, &argv);
+            if (!parse_size(value, &max_memory) || max_memory == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: %s expects a size like 512M or 2G, but got %s\n", arg, value);
+                exit(1);
+            }
+        } else if (strcmp(arg, "--cache-limit") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no value is provided for %s\n", arg);
+                exit(1);
+            }
+            const char *value = shift_args(&argc, &argv);
+            if (!parse_size(value, &cache_limit)) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: %s expects a size like 4096, 512K, 64M or 2G, but got %s\n", arg, value);
+                exit(1);
+            }
+        } else if (strcmp(arg, "--cells") == 0) {
+            if (argc == 0) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: no value is provided for %s\n", arg);
+                exit(1);
+            }
+            const char *value = shift_args(&argc, &argv);
+            if (!parse_cell_ranges(value, &selection)) {
+                usage(stderr);
+                fprintf(stderr, "ERROR: %s expects cells like A5,C10 or ranges like A1:B3, but got %s\n", arg, value);
+                exit(1);
+            }
+        } else if (strncmp(arg, "--layout=", 9) == 0) {
+            const char *value = arg + 9;
+            if (strcmp(value, "rows") == 0) {
+                layout = LAYOUT_ROWS;
+            } else if (strcmp(value, "columns") == 0) {
+                layout = LAYOUT_COLUMNS;
+            } else if (strcmp(value, "tiles") == 0) {
+                layout = LAYOUT_TILES;
+            } else {
+                usage(stderr);
+                fprintf(stderr, "ERROR: unknown layout %s\n", value);
+                exit(1);
+            }
+        } else if (strcmp(arg, "--pipeline") == 0) {
+            pipeline = true;
+        } else if (strcmp(arg, "--arrow") == 0) {
+            output_format = OUTPUT_FORMAT_ARROW;
+        } else if (strcmp(arg, "--help") == 0) {
+            usage(stdout);
+            exit(0);
+        } else if (input_file_path == NULL) {
+            input_file_path = arg;
+        } else {
+            usage(stderr);
+            fprintf(stderr, "ERROR: unexpected argument %s\n", arg);
+            exit(1);
+        }
+    }
+
+    if (input_file_path == NULL) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: input file is not provided\n");
+        exit(1);
+    }
+
+    if (pipeline && profile_top > 0) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --profile is not supported with --pipeline\n");
+        exit(1);
+    }
+
+    if (pipeline && output_format != OUTPUT_FORMAT_TEXT) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --pipeline supports only the text output\n");
+        exit(1);
+    }
+
+    if (selection.count > 0 && pipeline) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --cells is not supported with --pipeline\n");
+        exit(1);
+    }
+
+    if (selection.count > 0 && output_format != OUTPUT_FORMAT_TEXT) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --cells supports only the text output\n");
+        exit(1);
+    }
+
+    if (projection.count > 0 && (pipeline || selection.count > 0)) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --columns is not supported with --pipeline and --cells\n");
+        exit(1);
+    }
+
+    if (projection.count > 0 && output_format != OUTPUT_FORMAT_TEXT) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --columns supports only the text output\n");
+        exit(1);
+    }
+
+    if (use_index && pipeline) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --index is not supported with --pipeline\n");
+        exit(1);
+    }
+
+    if (watch && (pipeline || selection.count > 0 || projection.count > 0 || lazy || use_index)) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --watch is not supported with --pipeline, --cells, --columns, --lazy and --index\n");
+        exit(1);
+    }
+
+    if (watch && (stats_format != STATS_NONE || perf_enabled || trace_file_path != NULL || profile_top > 0)) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --watch never exits, so it does not support --stats, --perf, --trace and --profile\n");
+        exit(1);
+    }
+
+    if (cache_dir != NULL && (pipeline || selection.count > 0 || projection.count > 0 || lazy || use_index || watch || profile_top > 0)) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --cache is not supported with --pipeline, --cells, --columns, --lazy, --index, --watch and --profile\n");
+        exit(1);
+    }
+
+    if (text_pool && (pipeline || selection.count > 0 || projection.count > 0 || lazy || use_index || watch || cache_dir != NULL)) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --text-pool is not supported with --pipeline, --cells, --columns, --lazy, --index, --watch and --cache\n");
+        exit(1);
+    }
+
+    if (max_memory > 0 && (pipeline || watch)) {
+        usage(stderr);
+        fprintf(stderr, "ERROR: --max-memory is not supported with --pipeline and --watch\n");
+        exit(1);
+    }
+
+    if (perf_enabled) {
+        if (stats_format == STATS_NONE) {
+            stats_format = STATS_TEXT;
+        }
+        if (perf_open() == 0) {
+            fprintf(stderr, "WARNING: hardware performance counters are not available: %s\n",
+                    strerror(errno));
+        }
+    }
+
+    if (trace_file_path != NULL) {
+#ifdef MINICEL_NO_TRACE
+        fprintf(stderr, "ERROR: minicel was compiled without tracing\n");
+        exit(1);
+#endif
+        trace_enabled = true;
+        trace_start_ns = clock_ns();
+        TRACE_THREAD_NAME("main");
+    }
+
+    FILE *output = stdout;
+    if (output_file_path != NULL) {
+        output = fopen(output_file_path, "wb");
+        if (output == NULL) {
+            fprintf(stderr, "ERROR: could not open file %s: %s\n",
+                    output_file_path, strerror(errno));
+            exit(1);
+        }
+    }
+
+    if (watch) {
+        watch_run(input_file_path, output, output_format, jobs, layout);
+    } else if (pipeline) {
+        int input = open(input_file_path, O_RDONLY);
+        if (input < 0) {
+            fprintf(stderr, "ERROR: could not read file %s: %s\n",
+                    input_file_path, strerror(errno));
+            exit(1);
+        }
+
+        Phase_Start start = stats_phase_begin();
+        TRACE_BEGIN("pipeline");
+        pipeline_run(input, output, lazy);
+        TRACE_END("pipeline");
+        stats_phase_end(PHASE_PIPELINE, start);
+
+        close(input);
+    } else {
+        Phase_Start start = stats_phase_begin();
+        size_t content_size = 0;
+        TRACE_BEGIN("slurp_file");
+        char *content = NULL;
+        if (use_index || max_memory > 0) {
+            content = map_file(input_file_path, &content_size);
+            if (content != NULL && max_memory > 0 && content_size > 0) {
+                paged_track(content, content_size, -1);
+            }
+        } else {
+            content = slurp_file(input_file_path, &content_size);
+        }
+        TRACE_END("slurp_file");
+        if (content == NULL) {
+            fprintf(stderr, "ERROR: could not read file %s: %s\n",
+                    input_file_path, strerror(errno));
+            exit(1);
+        }
+        stats_phase_end(PHASE_READ, start);
+        stats.bytes_read = content_size;
+
+        String_View input = {
+            .count = content_size,
+            .data = content,
+        };
+
+        Expr_Buffer eb = {0};
+        Table table = {0};
+        Tmp_Cstr tc = {0};
+        size_t cells_count = 0;
+
+        Row_Index index = {0};
+        bool indexed = false;
+        if (use_index) {
+            start = stats_phase_begin();
+            TRACE_BEGIN("index_open");
+            struct stat st;
+            if (stat(input_file_path, &st) < 0) {
+                fprintf(stderr, "ERROR: could not read file %s: %s\n",
+                        input_file_path, strerror(errno));
+                exit(1);
+            }
+
+            String_Builder index_path = {0};
+            sb_append(&index_path, input_file_path, strlen(input_file_path));
+            sb_append(&index_path, ".idx", 5);
+
+            indexed = index_open(&index, index_path.items, input, &st);
+            if (!indexed) {
+                if (index_build(index_path.items, input, &st)) {
+                    indexed = index_open(&index, index_path.items, input, &st);
+                } else {
+                    fprintf(stderr, "WARNING: could not write index %s: %s\n",
+                            index_path.items, strerror(errno));
+                }
+            }
+            free(index_path.items);
+            TRACE_END("index_open");
+            stats_phase_end(PHASE_INDEX, start);
+        }
+
+        start = stats_phase_begin();
+        if (indexed) {
+            table.rows = index.header->rows;
+            table.cols = index.header->cols;
+            cells_count = index.header->cells;
+        } else {
+            TRACE_BEGIN("estimate_table_size");
+            estimate_table_size(input, &table.rows, &table.cols, &cells_count);
+            TRACE_END("estimate_table_size");
+        }
+        stats_phase_end(PHASE_ESTIMATE, start);
+
+        Cache cache = {0};
+        if (cache_dir != NULL) {
+            start = stats_phase_begin();
+            TRACE_BEGIN("cache_open");
+            cache_open(&cache, cache_dir, input_file_path, input, table.rows, table.cols);
+            TRACE_END("cache_open");
+            stats_phase_end(PHASE_CACHE, start);
+        }
+
+        start = stats_phase_begin();
+        table.layout = layout;
+        bool ragged = layout == LAYOUT_ROWS && table_should_be_ragged(table.rows, table.cols, cells_count);
+        // The selected cells of an indexed table are the only ones that
+        // get split out of their rows and parsed
+        bool load_rows = indexed && selection.count > 0;
+        if (ragged) {
+            if (load_rows) {
+                table.row_offsets = (size_t *) index.cell_offsets;
+            } else {
+                table.row_offsets = malloc(sizeof(*table.row_offsets) * (table.rows + 1));
+                assert(table.row_offsets != NULL && "Buy more RAM lol");
+            }
+            // One more cell for the empty cell past the end of every row
+            cells_count += 1;
+        } else {
+            cells_count = table_cells_count(&table);
+        }
+        // calloc() leaves the pages of the cells that are never touched
+        // unmapped, and so do the sparse temporary files
+        if (max_memory > 0) {
+            table.cells = paged_alloc(sizeof(*table.cells) * cells_count);
+        } else {
+            table.cells = calloc(cells_count > 0 ? cells_count : 1, sizeof(*table.cells));
+        }
+        assert(table.cells != NULL && "Buy more RAM lol");
+        TRACE_BEGIN("parse_table_from_content");
+        bool *projected = NULL;
+        if (projection.count > 0) {
+            projected = calloc(table.cols > 0 ? table.cols : 1, sizeof(*projected));
+            assert(projected != NULL && "Buy more RAM lol");
+            for (size_t i = 0; i < projection.count; ++i) {
+                if (projection.items[i] >= table.cols) {
+                    String_Builder sb = {0};
+                    column_name(&sb, projection.items[i]);
+                    fprintf(stderr, "ERROR: projected column %.*s is outside of the table\n", (int) sb.count, sb.items);
+                    exit(1);
+                }
+                projected[projection.items[i]] = true;
+            }
+        }
+        if (load_rows) {
+            table.rows_loaded = calloc(table.rows > 0 ? table.rows : 1, sizeof(*table.rows_loaded));
+            assert(table.rows_loaded != NULL && "Buy more RAM lol");
+            table.content = content;
+            table.line_offsets = index.line_offsets;
+        } else {
+            parse_table_from_content(&table, &eb, &tc, input, lazy || selection.count > 0, projected, cache.cached);
+        }
+        if (cache_dir != NULL) {
+            cache_fill(&cache, &table, &eb);
+        }
+        free(projected);
+        Text_Pool pool = {0};
+        if (text_pool) {
+            // Nothing points into the input once the texts are moved out
+            text_pool_cells(&pool, table.cells, cells_count);
+            free_input(content, content_size, use_index || max_memory > 0);
+            content = NULL;
+            input = (String_View) {0};
+        }
+        TRACE_END("parse_table_from_content");
+        stats_phase_end(PHASE_PARSE, start);
+
+        if (profile_top > 0) {
+            profile = malloc(sizeof(*profile) * (cells_count > 0 ? cells_count : 1));
+            memset(profile, 0, sizeof(*profile) * cells_count);
+        }
+
+        if (selection.count > 0) {
+            // The references are neither linked nor checked up front since
+            // that would need all the formulas to be parsed
+            start = stats_phase_begin();
+            TRACE_BEGIN("eval");
+            table_eval_selection(&table, &eb, &selection);
+            TRACE_END("eval");
+            stats_phase_end(PHASE_EVAL, start);
+        } else if (projection.count > 0) {
+            // Same as with --cells, only the formulas that are needed get parsed
+            start = stats_phase_begin();
+            TRACE_BEGIN("eval");
+            table_eval_projection(&table, &eb, &projection);
+            TRACE_END("eval");
+            stats_phase_end(PHASE_EVAL, start);
+        } else if (lazy) {
+            // Same as with --cells, the errors are only found during the
+            // evaluation. The text is written as the rows are evaluated,
+            // so the eval phase includes the output.
+            start = stats_phase_begin();
+            TRACE_BEGIN("eval");
+            if (output_format == OUTPUT_FORMAT_TEXT) {
+                table_eval_dump_text(output, &table, &eb);
+            } else {
+                for (size_t row = 0; row < table.rows; ++row) {
+                    for (size_t col = 0; col < table.cols; ++col) {
+                        table_eval_cell(&table, &eb, row, col);
+                    }
+                }
+            }
+            TRACE_END("eval");
+            stats_phase_end(PHASE_EVAL, start);
+        } else {
+            start = stats_phase_begin();
+            TRACE_BEGIN("table_link_refs");
+            table_link_refs(&table, &eb);
+            TRACE_END("table_link_refs");
+            stats_phase_end(PHASE_LINK, start);
+
+            start = stats_phase_begin();
+            TRACE_BEGIN("table_check_types");
+            Index_Array order = table_check_types(&table, &eb);
+            TRACE_END("table_check_types");
+            stats_phase_end(PHASE_CHECK, start);
+
+            start = stats_phase_begin();
+            TRACE_BEGIN("eval");
+            if (profile) {
+                // The profiler measures every formula together with the
+                // formulas it pulls in, so it keeps the recursive evaluation
+                for (size_t row = 0; row < table.rows; ++row) {
+                    for (size_t col = 0; col < table.cols; ++col) {
+                        table_eval_cell(&table, &eb, row, col);
+                    }
+                }
+            } else if (vectorize && table.clones > 0 && table.row_offsets == NULL && table.layout == LAYOUT_ROWS) {
+                // Only the copies share their expressions
+                table_eval_vectorized(&table, &eb);
+            } else {
+                table_eval_ordered(&table, &eb, &order);
+            }
+            paged_free(order.items);
+            TRACE_END("eval");
+            stats_phase_end(PHASE_EVAL, start);
+        }
+
+        start = stats_phase_begin();
+        TRACE_BEGIN("output");
+        if (selection.count > 0) {
+            table_dump_selection(output, &table, &selection);
+        } else if (projection.count > 0) {
+            table_dump_projection(output, &table, &projection);
+        } else if (lazy && output_format == OUTPUT_FORMAT_TEXT) {
+            // Already written by table_eval_dump_text()
+        } else {
+            switch (output_format) {
+            case OUTPUT_FORMAT_TEXT:
+                // The formatting threads keep all their text in memory
+                table_dump_text_parallel(output, &table, max_memory > 0 ? 1 : jobs);
+                break;
+
+            case OUTPUT_FORMAT_ARROW:
+                table_dump_arrow(output, &table);
+                break;
+            }
+        }
+        fflush(output);
+        TRACE_END("output");
+        stats_phase_end(PHASE_OUTPUT, start);
+
+        if (cache_dir != NULL) {
+            start = stats_phase_begin();
+            TRACE_BEGIN("cache_save");
+            cache_save(&cache, &table, &eb, content, content_size, cache_dir, cache_limit);
+            cache_close(&cache);
+            TRACE_END("cache_save");
+            stats_phase_end(PHASE_CACHE, start);
+        }
+
+        if (stats_format != STATS_NONE) {
+            stats.exprs = eb.count;
+            stats_count_cells(&table);
+        }
+
+        if (profile) {
+            profile_report(stderr, &table, &eb, profile_top);
+            free(profile);
+            profile = NULL;
+        }
+
+        if (content != NULL) {
+            free_input(content, content_size, use_index || max_memory > 0);
+        }
+        text_pool_free(&pool);
+        paged_free(table.cells);
+        if (!load_rows) {
+            free(table.row_offsets);
+        }
+        free(table.rows_loaded);
+        index_close(&index);
+        free(selection.items);
+        free(projection.items);
+        paged_free(eb.items);
+        free(tc.cstr);
+    }
+
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    switch (stats_format) {
+    case STATS_NONE:
+        break;
+
+    case STATS_TEXT:
+        stats_report_text(stderr);
+        break;
+
+    case STATS_JSON:
+        stats_report_json(stderr);
+        break;
+    }
+
+    if (perf_enabled) {
+        perf_close();
+    }
+
+    if (trace_file_path != NULL) {
+        FILE *f = fopen(trace_file_path, "wb");
+        if (f == NULL) {
+            fprintf(stderr, "ERROR: could not open file %s: %s\n",
+                    trace_file_path, strerror(errno));
+            exit(1);
+        }
+        trace_dump(f);
+        fclose(f);
+        trace_free();
+    }
 
     return 0;
 }
@@ -0,0 +1,275 @@
+// Reads an Arrow IPC stream written by `minicel --arrow` and prints it the
+// way the text output of minicel looks: the column names, then the rows,
+// with the nulls as empty fields. `./nobuild test` compares the two.
+//
+// It is a reader of its own that does not share any code with the writer
+// in src/main.c, so a mistake in the writer does not cancel itself out.
+// It only supports what minicel writes: float64 and utf8 columns in a
+// little-endian stream.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_UTF8 5
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} Bytes;
+
+void fail(const char *message)
+{
+    fprintf(stderr, "ERROR: %s\n", message);
+    exit(1);
+}
+
+uint32_t read_u32(Bytes b, size_t at)
+{
+    if (at + 4 > b.size) {
+        fail("unexpected end of the stream");
+    }
+    uint32_t x;
+    memcpy(&x, b.data + at, sizeof(x));
+    return x;
+}
+
+int64_t read_i64(Bytes b, size_t at)
+{
+    if (at + 8 > b.size) {
+        fail("unexpected end of the stream");
+    }
+    int64_t x;
+    memcpy(&x, b.data + at, sizeof(x));
+    return x;
+}
+
+// Position of the field `id` of the flatbuffer table at `table`, 0 when
+// the field is absent
+size_t fb_field(Bytes b, size_t table, size_t id)
+{
+    int32_t soffset = (int32_t) read_u32(b, table);
+    size_t vtable = (size_t) ((int64_t) table - soffset);
+    uint16_t vtable_size;
+    memcpy(&vtable_size, b.data + vtable, sizeof(vtable_size));
+    if ((2 + id) * sizeof(uint16_t) >= vtable_size) {
+        return 0;
+    }
+    uint16_t offset;
+    memcpy(&offset, b.data + vtable + (2 + id) * sizeof(uint16_t), sizeof(offset));
+    return offset == 0 ? 0 : table + offset;
+}
+
+// Follows the offset stored at `at`
+size_t fb_deref(Bytes b, size_t at)
+{
+    return at + read_u32(b, at);
+}
+
+typedef struct {
+    char *name;
+    uint8_t type;
+} Column;
+
+typedef struct {
+    Column *items;
+    size_t count;
+} Columns;
+
+void print_field(const char *text, size_t count)
+{
+    bool quoted = false;
+    for (size_t i = 0; i < count; ++i) {
+        if (text[i] == '|' || text[i] == '"' || text[i] == '\n') {
+            quoted = true;
+        }
+    }
+
+    if (!quoted) {
+        fwrite(text, 1, count, stdout);
+        return;
+    }
+
+    putchar('"');
+    for (size_t i = 0; i < count; ++i) {
+        if (text[i] == '"') {
+            putchar('"');
+        }
+        putchar(text[i]);
+    }
+    putchar('"');
+}
+
+void read_schema(Bytes m, size_t schema, Columns *columns)
+{
+    size_t fields = fb_deref(m, fb_field(m, schema, 1));
+    columns->count = read_u32(m, fields);
+    columns->items = calloc(columns->count, sizeof(*columns->items));
+    for (size_t i = 0; i < columns->count; ++i) {
+        size_t field = fb_deref(m, fields + 4 + 4 * i);
+        size_t name = fb_deref(m, fb_field(m, field, 0));
+        uint32_t count = read_u32(m, name);
+        columns->items[i].name = malloc(count + 1);
+        memcpy(columns->items[i].name, m.data + name + 4, count);
+        columns->items[i].name[count] = '\0';
+        columns->items[i].type = m.data[fb_field(m, field, 2)];
+        if (columns->items[i].type != ARROW_TYPE_FLOATING_POINT && columns->items[i].type != ARROW_TYPE_UTF8) {
+            fail("unsupported column type");
+        }
+    }
+}
+
+void print_record_batch(Bytes m, size_t batch, Bytes body, const Columns *columns)
+{
+    int64_t length = read_i64(m, fb_field(m, batch, 0));
+    size_t nodes = fb_deref(m, fb_field(m, batch, 1));
+    size_t buffers = fb_deref(m, fb_field(m, batch, 2));
+    if (read_u32(m, nodes) != columns->count) {
+        fail("the number of field nodes does not match the schema");
+    }
+
+    // validity, [offsets,] values of every column
+    const uint8_t **validity = calloc(columns->count, sizeof(*validity));
+    const int32_t **offsets = calloc(columns->count, sizeof(*offsets));
+    const uint8_t **values = calloc(columns->count, sizeof(*values));
+    size_t buffer = 0;
+    for (size_t col = 0; col < columns->count; ++col) {
+        int64_t node_length = read_i64(m, nodes + 4 + 16 * col);
+        int64_t null_count = read_i64(m, nodes + 4 + 16 * col + 8);
+        if (node_length != length) {
+            fail("the length of a column does not match the record batch");
+        }
+
+        size_t n = columns->items[col].type == ARROW_TYPE_UTF8 ? 3 : 2;
+        for (size_t i = 0; i < n; ++i, ++buffer) {
+            int64_t offset = read_i64(m, buffers + 4 + 16 * buffer);
+            int64_t size = read_i64(m, buffers + 4 + 16 * buffer + 8);
+            if (offset < 0 || size < 0 || (size_t) (offset + size) > body.size) {
+                fail("a buffer is outside of the message body");
+            }
+            const uint8_t *data = body.data + offset;
+            if (i == 0) {
+                validity[col] = size > 0 ? data : NULL;
+                if (null_count > 0 && size == 0) {
+                    fail("a column with nulls has no validity bitmap");
+                }
+            } else if (i == 1 && n == 3) {
+                offsets[col] = (const int32_t *) data;
+            } else {
+                values[col] = data;
+            }
+        }
+    }
+
+    for (int64_t row = 0; row < length; ++row) {
+        for (size_t col = 0; col < columns->count; ++col) {
+            if (col > 0) {
+                putchar('|');
+            }
+            if (validity[col] && !(validity[col][row / 8] & (1 << (row % 8)))) {
+                continue;
+            }
+            if (columns->items[col].type == ARROW_TYPE_FLOATING_POINT) {
+                double x;
+                memcpy(&x, values[col] + 8 * row, sizeof(x));
+                printf("%lf", x);
+            } else {
+                int32_t begin = offsets[col][row];
+                int32_t end = offsets[col][row + 1];
+                print_field((const char *) values[col] + begin, (size_t) (end - begin));
+            }
+        }
+        putchar('\n');
+    }
+
+    free(validity);
+    free(offsets);
+    free(values);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <stream.arrow>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        fail("could not open the stream");
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? (size_t) size : 1);
+    if (fread(data, 1, (size_t) size, f) != (size_t) size) {
+        fail("could not read the stream");
+    }
+    fclose(f);
+    Bytes stream = {.data = data, .size = (size_t) size};
+
+    Columns columns = {0};
+    bool schema_read = false;
+    size_t at = 0;
+    for (;;) {
+        if (read_u32(stream, at) != 0xFFFFFFFF) {
+            fail("a message does not start with the continuation marker");
+        }
+        uint32_t metadata_size = read_u32(stream, at + 4);
+        at += 8;
+        if (metadata_size == 0) {
+            break;
+        }
+        if (metadata_size % 8 != 0 || at + metadata_size > stream.size) {
+            fail("the metadata of a message is not padded to 8 bytes");
+        }
+
+        Bytes m = {.data = stream.data + at, .size = metadata_size};
+        size_t message = fb_deref(m, 0);
+        uint8_t header_type = m.data[fb_field(m, message, 1)];
+        size_t header = fb_deref(m, fb_field(m, message, 2));
+        size_t body_length_field = fb_field(m, message, 3);
+        int64_t body_length = body_length_field ? read_i64(m, body_length_field) : 0;
+        at += metadata_size;
+        if (body_length < 0 || at + (size_t) body_length > stream.size) {
+            fail("the body of a message is outside of the stream");
+        }
+        Bytes body = {.data = stream.data + at, .size = (size_t) body_length};
+        at += (size_t) body_length;
+
+        if (header_type == ARROW_HEADER_SCHEMA) {
+            read_schema(m, header, &columns);
+            for (size_t col = 0; col < columns.count; ++col) {
+                if (col > 0) {
+                    putchar('|');
+                }
+                print_field(columns.items[col].name, strlen(columns.items[col].name));
+            }
+            putchar('\n');
+            schema_read = true;
+        } else if (header_type == ARROW_HEADER_RECORD_BATCH) {
+            if (!schema_read) {
+                fail("a record batch comes before the schema");
+            }
+            print_record_batch(m, header, body, &columns);
+        } else {
+            fail("unsupported message type");
+        }
+    }
+
+    if (at != stream.size) {
+        fail("there is data after the end-of-stream marker");
+    }
+
+    for (size_t col = 0; col < columns.count; ++col) {
+        free(columns.items[col].name);
+    }
+    free(columns.items);
+    free(data);
+    return 0;
+}